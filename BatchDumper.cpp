@@ -0,0 +1,303 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#include "BatchDumper.h"
+
+#include "Concurrency.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#define strcasecmp _stricmp
+#else
+#include <strings.h>
+#include <unistd.h>
+#endif
+
+namespace google_breakpad
+{
+
+namespace
+{
+
+uint64_t fileSize(const char* path)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path, &st) != 0)
+		return 0;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return 0;
+#endif
+	return (uint64_t)st.st_size;
+}
+
+// Unique among every process writing to the same directory
+std::string tempSuffix()
+{
+	static std::atomic<uint32_t> counter(0);
+	return "." + std::to_string((long long)getpid()) + "-" + std::to_string(counter++) + ".tmp";
+}
+
+} // namespace
+
+BatchDumper::BatchDumper(const std::string& outputDir, size_t memoryBudget, Setup setup)
+	: m_outputDir(outputDir)
+	, m_budget(memoryBudget)
+	, m_setup(std::move(setup))
+	, m_symbolStore(false)
+	, m_usedBytes(0)
+	, m_peakBytes(0)
+	, m_inFlight(0)
+{
+}
+
+std::string
+BatchDumper::SymbolFileName(const std::string& path)
+{
+	std::string name(path);
+	size_t loc = name.find_last_of("/\\");
+	if (loc != std::string::npos)
+		name.erase(0, loc + 1);
+
+	const char* suffixes[] = { ".gz", ".zst", ".zstd" };
+	for (auto suffix : suffixes)
+	{
+		size_t len = strlen(suffix);
+		if (name.size() > len && strcasecmp(name.c_str() + name.size() - len, suffix) == 0)
+		{
+			name.erase(name.size() - len);
+			break;
+		}
+	}
+
+	if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".pdb") == 0)
+		name.erase(name.size() - 4);
+
+	return name + ".sym";
+}
+
+void
+BatchDumper::Add(const std::string& path)
+{
+	Job job;
+	job.path = path;
+	// The mapping and what gets copied out of it both grow with the file
+	job.cost = fileSize(path.c_str());
+	m_jobs.push_back(std::move(job));
+}
+
+bool
+BatchDumper::AddManifest(const char* path)
+{
+	FILE* manifest = fopen(path, "r");
+	if (!manifest)
+		return false;
+
+	char line[4096];
+	while (fgets(line, sizeof(line), manifest))
+	{
+		size_t len = strlen(line);
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+			line[--len] = 0;
+
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		Add(line);
+	}
+
+	fclose(manifest);
+	return true;
+}
+
+size_t
+BatchDumper::Run()
+{
+	if (!makeDirectories(m_outputDir))
+	{
+		fprintf(stderr, "Failed to create %s\n", m_outputDir.c_str());
+		return m_jobs.size();
+	}
+
+	// PDBs with the same name from different directories mustn't overwrite
+	// each other. In a symbol store their ids keep them apart, unless they
+	// really are the same PDB.
+	if (!m_symbolStore)
+	{
+		std::map<std::string, size_t> outputs;
+		for (auto& job : m_jobs)
+		{
+			job.output = SymbolFileName(job.path);
+			size_t count = ++outputs[job.output];
+			if (count > 1)
+			{
+				std::string unique = job.output.substr(0, job.output.size() - 4) + "-" + std::to_string(count) + ".sym";
+				fprintf(stderr, "Warning: %s is already being written, writing %s to %s instead\n",
+					job.output.c_str(), job.path.c_str(), unique.c_str());
+				job.output = unique;
+			}
+		}
+	}
+
+	// Biggest first, so the small ones fill in around the big ones at the
+	// end instead of a big one being left to grind on its own
+	std::vector<const Job*> order;
+	for (auto& job : m_jobs)
+		order.push_back(&job);
+	std::stable_sort(order.begin(), order.end(), [](const Job* a, const Job* b) { return a->cost > b->cost; });
+
+	// Every PDB in flight takes up a thread for the parts of it that aren't
+	// parallel, more than that would only hold on to memory for nothing
+	size_t maxInFlight = Concurrency::GetProcessorCount();
+
+	std::atomic<size_t> failed(0);
+
+	Concurrency::task_group tg;
+	for (auto job : order)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_room.wait(lock, [this, job, maxInFlight] {
+				return m_inFlight == 0 || (m_inFlight < maxInFlight && (!m_budget || m_usedBytes + job->cost <= m_budget));
+			});
+
+			++m_inFlight;
+			m_usedBytes += job->cost;
+			m_peakBytes = std::max(m_peakBytes, m_usedBytes);
+		}
+
+		tg.run([this, job, &failed]() {
+			PDBParser* parser = acquireParser();
+			if (!dump(*job, *parser))
+				++failed;
+			releaseParser(parser);
+
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				--m_inFlight;
+				m_usedBytes -= job->cost;
+			}
+			m_room.notify_all();
+		});
+	}
+	tg.wait();
+
+	return failed;
+}
+
+void
+BatchDumper::WriteAtomically(PDBParser& parser, const std::string& root, const std::string& path)
+{
+	std::string output = root + "/" + path;
+	size_t dir = output.find_last_of("/\\");
+	if (!makeDirectories(output.substr(0, dir)))
+		throw std::runtime_error("Failed to create the directory for " + output);
+
+	std::string temp = output + tempSuffix();
+	FILE* of = fopen(temp.c_str(), "wb");
+	if (!of)
+		throw std::runtime_error("Failed to open " + temp + " for writing");
+
+	try
+	{
+		parser.printBreakpadSymbols(of);
+
+		// All of it has to be on disk before the rename can make it visible
+		if (!syncFile(of))
+			throw std::runtime_error("Failed to write " + temp + ": " + strerror(errno));
+	}
+	catch (...)
+	{
+		fclose(of);
+		remove(temp.c_str());
+		throw;
+	}
+
+	if (fclose(of) != 0)
+	{
+		remove(temp.c_str());
+		throw std::runtime_error("Failed to write " + temp + ": " + strerror(errno));
+	}
+
+	if (!replaceFile(temp.c_str(), output.c_str()))
+	{
+		remove(temp.c_str());
+		throw std::runtime_error("Failed to write " + output);
+	}
+}
+
+bool
+BatchDumper::dump(const Job& job, PDBParser& parser)
+{
+	bool ok = true;
+	try
+	{
+		if (m_setup)
+			m_setup(parser);
+		parser.load(job.path.c_str());
+		WriteAtomically(parser, m_outputDir, m_symbolStore ? parser.symbolStorePath() : job.output);
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "Failed to dump %s: %s\n", job.path.c_str(), e.what());
+		ok = false;
+	}
+	parser.close();
+
+	return ok;
+}
+
+PDBParser*
+BatchDumper::acquireParser()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_idle.empty())
+	{
+		m_parsers.emplace_back(new PDBParser);
+		return m_parsers.back().get();
+	}
+
+	PDBParser* parser = m_idle.back();
+	m_idle.pop_back();
+	return parser;
+}
+
+void
+BatchDumper::releaseParser(PDBParser* parser)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_idle.push_back(parser);
+}
+
+} // google_breakpad
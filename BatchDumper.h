@@ -0,0 +1,106 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#pragma once
+
+#include "PDBParser.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace google_breakpad
+{
+
+// Dumps many PDBs into a directory from one process. Every PDB is a task on
+// the same pool its modules and types are parsed on, so the cores one PDB
+// leaves idle go to the next ones. PDBs are started biggest first, while
+// the ones in flight fit in a memory budget, and parsers are reused
+// between PDBs so that their arenas don't have to be allocated again.
+class BatchDumper
+{
+public:
+	// Called on every parser before it loads a PDB, to set it up
+	typedef std::function<void(PDBParser&)> Setup;
+
+	// memoryBudget is in bytes, 0 is no limit
+	BatchDumper(const std::string& outputDir, size_t memoryBudget = 0, Setup setup = Setup());
+
+	// Write to <name>.pdb/<id>/<name>.sym under the output directory, the
+	// layout of a Breakpad symbol store, instead of <name>.sym
+	void useSymbolStore(bool use) { m_symbolStore = use; }
+
+	void Add(const std::string& path);
+	// Adds every PDB listed in a file, one path per line. Blank lines and
+	// lines starting with # are skipped.
+	bool AddManifest(const char* path);
+
+	// Dumps everything added, and returns how many of them failed
+	size_t Run();
+
+	// What a PDB's symbols are written to, relative to the output directory,
+	// unless a symbol store is being written to
+	static std::string SymbolFileName(const std::string& path);
+
+	// Writes the PDB's symbols to root/path, through a temporary file that is
+	// renamed over it when complete, so that nothing ever sees part of one.
+	// Any number of threads and processes can write to the same root at once.
+	static void WriteAtomically(PDBParser& parser, const std::string& root, const std::string& path);
+
+	// The most memory the PDBs in flight were estimated to need at once. It
+	// only goes over the budget for a PDB bigger than all of it, which then
+	// runs on its own.
+	uint64_t PeakBytes() const { return m_peakBytes; }
+	size_t ParsersCreated() const { return m_parsers.size(); }
+
+private:
+	struct Job
+	{
+		std::string		path;
+		std::string		output;	//!< Empty when writing to a symbol store
+		uint64_t		cost;	//!< Roughly how much memory dumping it takes
+	};
+
+	bool dump(const Job& job, PDBParser& parser);
+	PDBParser* acquireParser();
+	void releaseParser(PDBParser* parser);
+
+	std::string							m_outputDir;
+	uint64_t							m_budget;
+	Setup								m_setup;
+	bool								m_symbolStore;
+	std::vector<Job>					m_jobs;
+
+	std::mutex							m_lock;
+	std::condition_variable				m_room;
+	uint64_t							m_usedBytes;
+	uint64_t							m_peakBytes;
+	size_t								m_inFlight;
+	std::vector<std::unique_ptr<PDBParser>>	m_parsers;
+	std::vector<PDBParser*>				m_idle;
+};
+
+} // google_breakpad
@@ -0,0 +1,136 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#include "ChunkWriter.h"
+
+#include <algorithm>
+#include <errno.h>
+
+namespace google_breakpad
+{
+
+ChunkWriter::ChunkWriter(FILE* of, size_t capacity)
+	: m_file(of)
+	, m_capacity(std::max<size_t>(capacity, 1))
+	, m_claimed(0)
+	, m_next(0)
+	, m_bytes(0)
+	, m_peakBytes(0)
+	, m_error(0)
+	, m_stop(false)
+{
+	m_thread = std::thread(&ChunkWriter::work, this);
+}
+
+ChunkWriter::~ChunkWriter()
+{
+	// If we are being unwound some chunks might never arrive
+	Cancel();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void
+ChunkWriter::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_ready.notify_all();
+	m_room.notify_all();
+}
+
+size_t
+ChunkWriter::Claim(size_t count)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	size_t first = m_claimed;
+	m_claimed += count;
+	return first;
+}
+
+void
+ChunkWriter::Write(size_t seq, std::string&& text)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	// The next chunk to be written always gets in, so this can't deadlock
+	m_room.wait(lock, [this, seq] { return m_stop || seq < m_next + m_capacity; });
+	if (m_stop)
+		return;
+
+	m_bytes += text.size();
+	m_peakBytes = std::max(m_peakBytes, m_bytes);
+	m_chunks[seq] = std::move(text);
+
+	if (seq == m_next)
+		m_ready.notify_one();
+}
+
+void
+ChunkWriter::Finish()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_room.wait(lock, [this] { return m_stop || m_next == m_claimed; });
+		m_stop = true;
+	}
+	m_ready.notify_all();
+
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void
+ChunkWriter::work()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (true)
+	{
+		m_ready.wait(lock, [this] { return m_stop || (!m_chunks.empty() && m_chunks.begin()->first == m_next); });
+
+		if (m_chunks.empty() || m_chunks.begin()->first != m_next)
+			return;
+
+		std::string text = std::move(m_chunks.begin()->second);
+		m_chunks.erase(m_chunks.begin());
+
+		bool failed = m_error != 0;
+		lock.unlock();
+		int error = 0;
+		if (!failed && fwrite(text.data(), 1, text.size(), m_file) != text.size())
+			error = errno ? errno : EIO;
+		lock.lock();
+
+		if (error && !m_error)
+			m_error = error;
+
+		m_bytes -= text.size();
+		++m_next;
+		m_room.notify_all();
+	}
+}
+
+} // google_breakpad
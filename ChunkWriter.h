@@ -0,0 +1,87 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+
+namespace google_breakpad
+{
+
+// Writes numbered chunks of text to a file in order, on a thread of its own,
+// so that formatting the next chunks overlaps with writing the last ones.
+// Chunks can be handed over in any order, but only a few past the next one to
+// be written are held on to, writing any further ahead blocks until there is
+// room. That keeps the formatted text that is waiting around bounded.
+class ChunkWriter
+{
+public:
+	// Formatters aim for chunks of about this size
+	enum { ChunkSize = 64 * 1024 };
+
+	ChunkWriter(FILE* of, size_t capacity);
+	~ChunkWriter();
+
+	// Numbers the next count chunks, chunks are written in the order they are
+	// claimed. Returns the first of them.
+	size_t Claim(size_t count = 1);
+	void Write(size_t seq, std::string&& text);
+	// Waits for every claimed chunk to be written
+	void Finish();
+	// Drops whatever hasn't been written yet, for when some chunks are never
+	// going to arrive. Writes after this do nothing.
+	void Cancel();
+
+	// The most bytes that were ever waiting to be written at once
+	size_t PeakBytes() const { return m_peakBytes; }
+	// The errno of the first write that failed, 0 if none did. Chunks after
+	// it are dropped rather than written past a gap.
+	int Error() const { return m_error; }
+
+private:
+	void work();
+
+	FILE*							m_file;
+	size_t							m_capacity;		//!< In chunks
+
+	std::mutex						m_lock;
+	std::condition_variable			m_ready;		//!< The next chunk has arrived, or we are done
+	std::condition_variable			m_room;			//!< A chunk was written
+	std::map<size_t, std::string>	m_chunks;
+	size_t							m_claimed;
+	size_t							m_next;			//!< The next chunk to be written
+	size_t							m_bytes;
+	size_t							m_peakBytes;
+	int								m_error;
+	bool							m_stop;
+
+	std::thread						m_thread;
+};
+
+} // google_breakpad
@@ -0,0 +1,64 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#pragma once
+
+#ifdef HAVE_TBB
+#include "tbb/task_group.h"
+#include "tbb/parallel_sort.h"
+#include "tbb/compat/ppl.h"
+#else
+#include "ThreadPool.h"
+#endif
+
+#include <algorithm>
+#include <thread>
+
+// The bits of PPL we're using, from TBB if it was asked for, otherwise from
+// our own thread pool
+namespace Concurrency
+{
+#ifdef HAVE_TBB
+	using tbb::parallel_sort;
+
+	inline unsigned int GetProcessorCount()
+	{
+		return std::max(std::thread::hardware_concurrency(), 1u);
+	}
+#else
+	typedef google_breakpad::TaskGroup task_group;
+
+	// How many tasks can actually run at once, counting the thread waiting on them
+	inline unsigned int GetProcessorCount()
+	{
+		return (unsigned int)google_breakpad::ThreadPool::Default().Workers() + 1;
+	}
+
+	template<typename _Random_iterator>
+	inline void parallel_sort(const _Random_iterator &_Begin,
+		const _Random_iterator &_End)
+	{
+		google_breakpad::parallelSort(_Begin, _End);
+	}
+#endif
+}
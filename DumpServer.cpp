@@ -0,0 +1,550 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#include "DumpServer.h"
+
+#include "Concurrency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(MSG_NOSIGNAL)
+// Not there on macOS, where ignoring SIGPIPE has to do
+#define MSG_NOSIGNAL 0
+#endif
+
+#if !defined(_WIN32) && !defined(MSG_CMSG_CLOEXEC)
+// Not there on macOS either, where received fds are marked afterwards
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+namespace google_breakpad
+{
+
+#ifndef _WIN32
+namespace
+{
+
+// Longer than this and it isn't a request
+const size_t MaxRequest = 64 * 1024;
+
+bool sendAll(int fd, const char* data, size_t size)
+{
+	while (size)
+	{
+		ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+
+		data += sent;
+		size -= (size_t)sent;
+	}
+	return true;
+}
+
+// A client that hasn't sent its whole request by then is dropped
+const std::chrono::seconds RequestTimeout(30);
+
+enum class ReadResult
+{
+	Incomplete,
+	Complete,
+	Failed
+};
+
+// Reads whatever has arrived of the request line without blocking, and the
+// fd passed along with it if there was one
+ReadResult readRequest(int conn, std::string& line, int& fd)
+{
+	char buffer[4096];
+
+	while (line.size() < MaxRequest)
+	{
+		char control[CMSG_SPACE(sizeof(int))];
+		iovec iov = { buffer, sizeof(buffer) };
+		msghdr msg = {};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		// Received fds mustn't leak into any processes the server starts
+		ssize_t got = recvmsg(conn, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return ReadResult::Incomplete;
+		if (got <= 0)
+			break;
+
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			// Only the first fd is used, any others would just leak
+			size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (size_t i = 0; i < count; ++i)
+			{
+				int received;
+				memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+				if (MSG_CMSG_CLOEXEC == 0)
+					fcntl(received, F_SETFD, FD_CLOEXEC);
+				if (fd < 0)
+					fd = received;
+				else
+					::close(received);
+			}
+		}
+
+		size_t start = line.size();
+		line.append(buffer, (size_t)got);
+		size_t end = line.find('\n', start);
+		if (end != std::string::npos)
+		{
+			line.erase(end);
+			return ReadResult::Complete;
+		}
+	}
+
+	return ReadResult::Failed;
+}
+
+int connectTo(const char* path, std::string& error)
+{
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		error = "Socket path is too long";
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (const sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		error = std::string("Failed to connect to ") + path + ": " + strerror(errno);
+		if (sock >= 0)
+			::close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+bool readReply(int sock, std::string& output, std::string& error)
+{
+	std::string reply;
+	char buffer[64 * 1024];
+	while (true)
+	{
+		ssize_t got = recv(sock, buffer, sizeof(buffer), 0);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+		{
+			error = std::string("Failed to read the reply: ") + strerror(errno);
+			return false;
+		}
+		if (got == 0)
+			break;
+		reply.append(buffer, (size_t)got);
+	}
+
+	size_t end = reply.find('\n');
+	if (end == std::string::npos)
+	{
+		error = "The server closed the connection without replying";
+		return false;
+	}
+
+	if (reply.compare(0, end, "OK") != 0)
+	{
+		error = reply.compare(0, 6, "ERROR ") == 0 ? reply.substr(6, end - 6) : reply.substr(0, end);
+		return false;
+	}
+
+	output.assign(reply, end + 1, std::string::npos);
+
+	// A dump that failed part way through ends with an ERROR line
+	size_t last = output.size() > 1 ? output.rfind('\n', output.size() - 2) : std::string::npos;
+	last = last == std::string::npos ? 0 : last + 1;
+	if (output.compare(last, 6, "ERROR ") == 0)
+	{
+		error = output.substr(last + 6);
+		if (!error.empty() && error.back() == '\n')
+			error.pop_back();
+		output.erase(last);
+		return false;
+	}
+
+	return true;
+}
+
+} // namespace
+#endif
+
+DumpServer::DumpServer(Setup setup)
+	: m_setup(std::move(setup))
+	, m_listen(-1)
+	, m_requests(0)
+{
+	m_wake[0] = m_wake[1] = -1;
+}
+
+DumpServer::~DumpServer()
+{
+	Stop();
+}
+
+bool
+DumpServer::Start(const char* path)
+{
+#ifdef _WIN32
+	(void)path;
+	fprintf(stderr, "The dump server needs Unix domain sockets, which aren't supported on Windows\n");
+	return false;
+#else
+	Stop();
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_listen < 0)
+		return false;
+
+	unlink(path);
+	if (bind(m_listen, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_listen, 64) != 0 || pipe(m_wake) != 0)
+	{
+		fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+		::close(m_listen);
+		m_listen = -1;
+		return false;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	m_path = path;
+	m_thread = std::thread(&DumpServer::accept, this);
+	return true;
+#endif
+}
+
+void
+DumpServer::Stop()
+{
+#ifndef _WIN32
+	if (m_listen < 0)
+		return;
+
+	char wake = 0;
+	while (write(m_wake[1], &wake, 1) < 0 && errno == EINTR)
+		;
+
+	if (m_thread.joinable())
+		m_thread.join();
+
+	::close(m_listen);
+	::close(m_wake[0]);
+	::close(m_wake[1]);
+	m_listen = m_wake[0] = m_wake[1] = -1;
+
+	unlink(m_path.c_str());
+#endif
+}
+
+size_t
+DumpServer::ParsersCreated() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_parsers.size();
+}
+
+void
+DumpServer::accept()
+{
+#ifndef _WIN32
+	// Connections whose request line is still arriving. They're read here
+	// rather than on the pool, so that clients that connect and then say
+	// nothing can't hold up the workers, or Stop.
+	struct Pending
+	{
+		int										conn;
+		int										fd;
+		std::string								line;
+		std::chrono::steady_clock::time_point	deadline;
+	};
+
+	Concurrency::task_group tg;
+	std::vector<Pending> pending;
+	std::vector<pollfd> fds;
+
+	while (true)
+	{
+		auto now = std::chrono::steady_clock::now();
+		int timeout = -1;
+
+		fds.assign(2 + pending.size(), pollfd());
+		fds[0].fd = m_listen;
+		fds[0].events = POLLIN;
+		fds[1].fd = m_wake[0];
+		fds[1].events = POLLIN;
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			fds[2 + i].fd = pending[i].conn;
+			fds[2 + i].events = POLLIN;
+
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(pending[i].deadline - now).count();
+			left = std::max<decltype(left)>(left, 0);
+			if (timeout < 0 || left < timeout)
+				timeout = (int)left;
+		}
+
+		if (poll(fds.data(), fds.size(), timeout) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Dump server failed to wait for connections: %s\n", strerror(errno));
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		now = std::chrono::steady_clock::now();
+		size_t kept = 0;
+		for (size_t i = 0; i < pending.size(); ++i)
+		{
+			Pending& request = pending[i];
+			ReadResult result = fds[2 + i].revents ? readRequest(request.conn, request.line, request.fd) : ReadResult::Incomplete;
+			if (result == ReadResult::Incomplete && now >= request.deadline)
+				result = ReadResult::Failed;
+
+			if (result == ReadResult::Complete)
+			{
+				// Only whole requests, which can be dumped right away, go to the pool
+				int conn = request.conn;
+				int fd = request.fd;
+				std::string line;
+				line.swap(request.line);
+				tg.run([this, conn, fd, line]() { serve(conn, line, fd); });
+			}
+			else if (result == ReadResult::Failed)
+			{
+				::close(request.conn);
+				if (request.fd >= 0)
+					::close(request.fd);
+			}
+			else if (kept != i)
+				pending[kept++] = std::move(request);
+			else
+				++kept;
+		}
+		pending.resize(kept);
+
+		if (fds[0].revents & POLLIN)
+		{
+			int conn = ::accept(m_listen, nullptr, nullptr);
+			if (conn >= 0)
+				pending.push_back(Pending{ conn, -1, std::string(), now + RequestTimeout });
+		}
+	}
+
+	for (Pending& request : pending)
+	{
+		::close(request.conn);
+		if (request.fd >= 0)
+			::close(request.fd);
+	}
+
+	tg.wait();
+#endif
+}
+
+void
+DumpServer::serve(int conn, const std::string& line, int fd)
+{
+#ifdef _WIN32
+	(void)conn;
+	(void)line;
+	(void)fd;
+#else
+	FILE* of = fdopen(conn, "w");
+	if (!of)
+	{
+		::close(conn);
+		if (fd >= 0)
+			::close(fd);
+		return;
+	}
+
+	PDBParser* parser = acquireParser();
+	try
+	{
+		if (m_setup)
+			m_setup(*parser);
+
+		if (line.compare(0, 5, "DUMP ") == 0)
+			parser->load(line.c_str() + 5);
+		else if (line.compare(0, 3, "FD ") == 0 && fd >= 0)
+			parser->load(fd, line.c_str() + 3);
+		else
+			throw std::runtime_error("Bad request");
+
+		fputs("OK\n", of);
+		parser->printBreakpadSymbols(of);
+	}
+	catch (const std::exception& e)
+	{
+		// Symbols are only ever written a whole line at a time
+		fprintf(of, "ERROR %s\n", e.what());
+	}
+	parser->close();
+	releaseParser(parser);
+
+	if (fd >= 0)
+		::close(fd);
+
+	// Counted before the client can see the reply end
+	++m_requests;
+	fclose(of);
+#endif
+}
+
+PDBParser*
+DumpServer::acquireParser()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_idle.empty())
+	{
+		m_parsers.emplace_back(new PDBParser);
+		return m_parsers.back().get();
+	}
+
+	PDBParser* parser = m_idle.back();
+	m_idle.pop_back();
+	return parser;
+}
+
+void
+DumpServer::releaseParser(PDBParser* parser)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_idle.push_back(parser);
+}
+
+bool
+DumpServer::Request(const char* socketPath, const char* pdbPath, std::string& output, std::string& error)
+{
+#ifdef _WIN32
+	(void)socketPath;
+	(void)pdbPath;
+	(void)output;
+	error = "Unix domain sockets aren't supported on Windows";
+	return false;
+#else
+	int sock = connectTo(socketPath, error);
+	if (sock < 0)
+		return false;
+
+	std::string request = std::string("DUMP ") + pdbPath + "\n";
+	bool ok = sendAll(sock, request.data(), request.size());
+	if (!ok)
+		error = "Failed to send the request";
+	else
+		ok = readReply(sock, output, error);
+
+	::close(sock);
+	return ok;
+#endif
+}
+
+bool
+DumpServer::Request(const char* socketPath, int fd, const char* name, std::string& output, std::string& error)
+{
+#ifdef _WIN32
+	(void)socketPath;
+	(void)fd;
+	(void)name;
+	(void)output;
+	error = "Unix domain sockets aren't supported on Windows";
+	return false;
+#else
+	int sock = connectTo(socketPath, error);
+	if (sock < 0)
+		return false;
+
+	std::string request = std::string("FD ") + name + "\n";
+
+	char control[CMSG_SPACE(sizeof(int))] = {};
+	iovec iov = { &request[0], request.size() };
+	msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	// The fd goes with the first byte, the rest of the line can follow
+	ssize_t sent;
+	while ((sent = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+
+	bool ok = sent > 0 && sendAll(sock, request.data() + sent, request.size() - (size_t)sent);
+	if (!ok)
+		error = "Failed to send the request";
+	else
+		ok = readReply(sock, output, error);
+
+	::close(sock);
+	return ok;
+#endif
+}
+
+} // google_breakpad
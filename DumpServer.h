@@ -0,0 +1,94 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#pragma once
+
+#include "PDBParser.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace google_breakpad
+{
+
+// Dumps PDBs for clients that connect to a Unix domain socket, so that many
+// small dumps don't each pay for starting a process, and the thread pool and
+// parsers, with their arenas, stay warm between them.
+//
+// Every connection is one request, a single line of either
+//   DUMP <path>\n
+//   FD <name>\n, with the PDB's fd passed along with it as SCM_RIGHTS
+// The reply is a line of either "OK" or "ERROR <message>", and after OK
+// the symbols, streamed as they are written, until the connection closes.
+// If the dump fails part way through the symbols end with an ERROR line,
+// which no line of symbols ever starts with.
+class DumpServer
+{
+public:
+	// Called on every parser before it loads a PDB, to set it up
+	typedef std::function<void(PDBParser&)> Setup;
+
+	explicit DumpServer(Setup setup = Setup());
+	~DumpServer();
+
+	// Listens on path, replacing whatever socket was there. Requests are
+	// dumped on the default pool. SIGPIPE is ignored from then on, so that a
+	// client that goes away doesn't take the server with it.
+	bool Start(const char* path);
+	// Stops accepting, then waits for the requests in flight to be done
+	void Stop();
+
+	uint64_t Requests() const { return m_requests; }
+	size_t ParsersCreated() const;
+
+	// A client for the above, true if the dump succeeded. output gets the
+	// symbols, error what went wrong if it didn't.
+	static bool Request(const char* socketPath, const char* pdbPath, std::string& output, std::string& error);
+	// The PDB is read from fd, which name is the file name of
+	static bool Request(const char* socketPath, int fd, const char* name, std::string& output, std::string& error);
+
+private:
+	void accept();
+	// Dumps the PDB a whole request line asks for, replying on conn
+	void serve(int conn, const std::string& line, int fd);
+	PDBParser* acquireParser();
+	void releaseParser(PDBParser* parser);
+
+	Setup									m_setup;
+	std::string								m_path;
+	int										m_listen;
+	int										m_wake[2];	//!< Written to when stopping, to wake up accept
+	std::thread								m_thread;
+	std::atomic<uint64_t>					m_requests;
+
+	mutable std::mutex						m_lock;
+	std::vector<std::unique_ptr<PDBParser>>	m_parsers;
+	std::vector<PDBParser*>					m_idle;
+};
+
+} // google_breakpad
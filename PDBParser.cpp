@@ -23,24 +23,34 @@
 
 #include "PDBParser.h"
 
+#include "ChunkWriter.h"
+#include "Concurrency.h"
+#include "Prefetcher.h"
+#include "StreamReader.h"
 #include "utils.h"
 #include <assert.h>
 #include <algorithm>
+#include <iterator>
 #ifdef _WIN32
-#include <ppl.h>
+#include <io.h>
+#define strcasecmp _stricmp
 #else
 #include <fcntl.h>
+#include <strings.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#ifdef HAVE_TBB
-#include "tbb/task_group.h"
-#include "tbb/parallel_sort.h"
-#include "tbb/compat/ppl.h"
-#endif
 #endif
+#include <atomic>
+#include <errno.h>
 #include <stdexcept>
 #include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #ifndef _WIN32
 #include <errno.h>
@@ -52,42 +62,6 @@ int fopen_s(FILE** f, const char* filename, const char* mode)
 		return 0;
 	return errno;
 }
-
-namespace Concurrency
-{
-#ifdef HAVE_TBB
-	using tbb::parallel_sort;
-#else
-	// Single-threaded implementation of the bits of PPL we're using.
-	enum task_group_status {
-		canceled,
-		completed,
-		not_complete
-	};
-
-	class task_group
-	{
-	public:
-		task_group() {}
-		task_group_status wait()
-		{
-			return completed;
-		}
-		template<typename _Function>
-		void run(const _Function& _Func)
-		{
-			_Func();
-		}
-	};
-
-	template<typename _Random_iterator>
-	inline void parallel_sort(const _Random_iterator &_Begin,
-		const _Random_iterator &_End)
-	{
-		std::sort(_Begin, _End);
-	}
-#endif
-}
 #endif
 
 namespace google_breakpad
@@ -107,6 +81,11 @@ bool MMapWrapper::Map(const char* path)
 		return false;
 	}
 
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+		size.QuadPart = 0;
+	m_length = (size_t)size.QuadPart;
+
 	m_base = (const uint8_t*)MapViewOfFile(m_mapFile, FILE_MAP_READ, 0, 0, 0);
 	CloseHandle(file);
 	if (m_base == nullptr)
@@ -144,6 +123,12 @@ bool MMapWrapper::Map(const char* path)
 			return false;
 		m_base = reinterpret_cast<const uint8_t*>(data);
 #endif
+		m_decompressed = false;
+		if (!decompress())
+		{
+			Unmap();
+			return false;
+		}
 		return true;
 }
 
@@ -152,274 +137,1127 @@ bool MMapWrapper::Unmap()
 	if (!Valid())
 		return false;
 
+	m_plan.clear();
+
+	if (m_decompressed)
+	{
+#ifdef _WIN32
+		VirtualFree(const_cast<uint8_t*>(m_base), 0, MEM_RELEASE);
+#else
+		munmap(const_cast<uint8_t*>(m_base), m_length);
+#endif
+		m_decompressed = false;
+	}
+	else
+		unmapFile();
+
+	m_base = nullptr;
+	return true;
+}
+
+void MMapWrapper::unmapFile()
+{
 #ifdef _WIN32
 	UnmapViewOfFile(m_base);
 	CloseHandle(m_mapFile);
+	m_mapFile = nullptr;
 #else
 	munmap(const_cast<uint8_t*>(m_base), m_length);
 #endif
+}
+
+namespace
+{
+	enum Compression
+	{
+		Uncompressed,
+		Gzip,
+		Zstd
+	};
+
+	Compression detectCompression(const uint8_t* data, size_t size)
+	{
+		if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+			return Gzip;
+		if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+			return Zstd;
+		return Uncompressed;
+	}
+
+	// Memory that no file backs, for decompressed files to be written into
+	class AnonymousBuffer
+	{
+	public:
+		AnonymousBuffer()
+			: data(nullptr)
+			, size(0)
+			, capacity(0)
+		{}
+
+		~AnonymousBuffer()
+		{
+			if (data)
+				release(data, capacity);
+		}
+
+		// Makes room for at least capacity bytes, keeping what has been written so far
+		bool reserve(size_t newCapacity)
+		{
+			if (newCapacity <= capacity)
+				return true;
+
+#ifdef _WIN32
+			uint8_t* grown = (uint8_t*)VirtualAlloc(nullptr, newCapacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (!grown)
+				return false;
+#else
+			void* mem = mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED)
+				return false;
+			uint8_t* grown = (uint8_t*)mem;
+#endif
+
+			if (data)
+			{
+				memcpy(grown, data, size);
+				release(data, capacity);
+			}
+
+			data = grown;
+			capacity = newCapacity;
+			return true;
+		}
+
+		bool grow()
+		{
+			return reserve(std::max<size_t>(capacity * 2, 1 << 20));
+		}
+
+		// Makes the memory read only like a mapped file would be, and hands it
+		// over. It has to be freed with the size it ends up with.
+		const uint8_t* detach()
+		{
+			uint8_t* detached = data;
+#ifdef _WIN32
+			DWORD old;
+			VirtualProtect(detached, capacity, PAGE_READONLY, &old);
+#else
+			// Give back the pages past the end, so that the size is all that's needed to free it
+			static const size_t sysPageSize = (size_t)sysconf(_SC_PAGESIZE);
+			size_t used = (size + sysPageSize - 1) & ~(sysPageSize - 1);
+			if (used < capacity)
+				munmap(detached + used, capacity - used);
+			mprotect(detached, used, PROT_READ);
+#endif
+			data = nullptr;
+			capacity = 0;
+			return detached;
+		}
+
+		uint8_t*	data;
+		size_t		size;
+		size_t		capacity;
+
+	private:
+		static void release(uint8_t* mem, size_t length)
+		{
+#ifdef _WIN32
+			(void)length;
+			VirtualFree(mem, 0, MEM_RELEASE);
+#else
+			munmap(mem, length);
+#endif
+		}
+	};
+
+#ifdef HAVE_ZLIB
+	bool inflateGzip(const uint8_t* in, size_t inSize, AnonymousBuffer& out)
+	{
+		// Every member ends with its size mod 2^32, which for the usual single
+		// member file is a good first guess at the size of the whole thing
+		uint32_t lastSize = 0;
+		if (inSize >= 4)
+			memcpy(&lastSize, in + inSize - 4, sizeof(lastSize));
+
+		if (!out.reserve(std::max<size_t>(lastSize, inSize) + 1))
+			return false;
+
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		if (inflateInit2(&zs, 15 + 16) != Z_OK)
+			return false;
+
+		// zlib only deals in 32 bit sizes, so the input is fed to it in chunks
+		const size_t maxChunk = 1 << 30;
+		size_t fed = 0;
+		bool ok = false;
+
+		while (true)
+		{
+			if (zs.avail_in == 0 && fed < inSize)
+			{
+				zs.next_in = (Bytef*)(in + fed);
+				zs.avail_in = (uInt)std::min(inSize - fed, maxChunk);
+				fed += zs.avail_in;
+			}
+
+			if (out.size == out.capacity && !out.grow())
+				break;
+
+			zs.next_out = out.data + out.size;
+			zs.avail_out = (uInt)std::min(out.capacity - out.size, maxChunk);
+			uInt avail = zs.avail_out;
+
+			int ret = inflate(&zs, Z_NO_FLUSH);
+			out.size += avail - zs.avail_out;
+
+			if (ret == Z_STREAM_END)
+			{
+				// Concatenated gzip files are still a single file
+				if (zs.avail_in == 0 && fed == inSize)
+				{
+					ok = true;
+					break;
+				}
+
+				inflateReset(&zs);
+			}
+			else if (ret == Z_BUF_ERROR)
+			{
+				// No progress with all of the input in means it was cut short
+				if (zs.avail_in == 0 && fed == inSize && zs.avail_out != 0)
+					break;
+			}
+			else if (ret != Z_OK)
+				break;
+		}
+
+		inflateEnd(&zs);
+		return ok;
+	}
+#endif
+
+#ifdef HAVE_ZSTD
+	bool decompressZstd(const uint8_t* in, size_t inSize, AnonymousBuffer& out)
+	{
+		struct Frame
+		{
+			size_t	in;
+			size_t	inSize;
+			size_t	out;
+			size_t	outSize;
+		};
+
+		// If every frame knows how big it decompresses to, each one has a place
+		// of its own in the output and they can all be decompressed at once
+		std::vector<Frame> frames;
+		size_t total = 0;
+		bool sized = true;
+
+		for (size_t offset = 0; offset < inSize && sized;)
+		{
+			size_t frameSize = ZSTD_findFrameCompressedSize(in + offset, inSize - offset);
+			if (ZSTD_isError(frameSize))
+				return false;
+
+			unsigned long long contentSize = ZSTD_getFrameContentSize(in + offset, frameSize);
+			if (contentSize == ZSTD_CONTENTSIZE_ERROR)
+				return false;
+
+			if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+				sized = false;
+			else
+			{
+				Frame frame = { offset, frameSize, total, (size_t)contentSize };
+				frames.push_back(frame);
+				total += (size_t)contentSize;
+			}
+
+			offset += frameSize;
+		}
+
+		if (sized)
+		{
+			if (!out.reserve(total + 1))
+				return false;
+
+			std::atomic<bool> failed(false);
+			Concurrency::task_group tg;
+			for (auto& frame : frames)
+			{
+				const Frame f = frame;
+				tg.run([f, in, &out, &failed]() {
+					size_t ret = ZSTD_decompress(out.data + f.out, f.outSize, in + f.in, f.inSize);
+					if (ZSTD_isError(ret) || ret != f.outSize)
+						failed = true;
+				});
+			}
+			tg.wait();
+
+			out.size = total;
+			return !failed;
+		}
+
+		// Otherwise it has to be done front to back, growing the output as we go
+		ZSTD_DStream* stream = ZSTD_createDStream();
+		if (!stream)
+			return false;
+		ZSTD_initDStream(stream);
+
+		ZSTD_inBuffer input = { in, inSize, 0 };
+		size_t ret = 1;
+		bool ok = out.reserve(inSize * 4);
+
+		while (ok && (input.pos < input.size || ret != 0))
+		{
+			if (out.size == out.capacity && !out.grow())
+			{
+				ok = false;
+				break;
+			}
+
+			ZSTD_outBuffer output = { out.data + out.size, out.capacity - out.size, 0 };
+			ret = ZSTD_decompressStream(stream, &output, &input);
+			out.size += output.pos;
+
+			// Room left over with all of the input used up means the last frame was cut short
+			if (ZSTD_isError(ret) || (ret != 0 && input.pos == input.size && output.pos < output.size))
+				ok = false;
+		}
+
+		ZSTD_freeDStream(stream);
+		return ok;
+	}
+#endif
+}
+
+bool MMapWrapper::IsCompressed(const char* filename)
+{
+	FILE* file = nullptr;
+	if (fopen_s(&file, filename, "rb") != 0)
+		return false;
+
+	uint8_t magic[4];
+	size_t numRead = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+
+	return detectCompression(magic, numRead) != Uncompressed;
+}
+
+bool MMapWrapper::decompress()
+{
+	Compression compression = detectCompression(m_base, m_length);
+	if (compression == Uncompressed)
+		return true;
+
+	AnonymousBuffer out;
+	bool ok = false;
+
+	if (compression == Gzip)
+	{
+#ifdef HAVE_ZLIB
+		ok = inflateGzip(m_base, m_length, out);
+#else
+		fprintf(stderr, "The PDB is gzip compressed, but zlib support was not built in\n");
+		return false;
+#endif
+	}
+	else
+	{
+#ifdef HAVE_ZSTD
+		ok = decompressZstd(m_base, m_length, out);
+#else
+		fprintf(stderr, "The PDB is zstd compressed, but zstd support was not built in\n");
+		return false;
+#endif
+	}
+
+	if (!ok || out.size == 0)
+	{
+		fprintf(stderr, "Failed to decompress the PDB\n");
+		return false;
+	}
+
+	unmapFile();
+
+	m_length = out.size;
+	m_base = out.detach();
+	m_decompressed = true;
 	return true;
 }
 
-PDBParser::FunctionRecord& PDBParser::FunctionRecord::operator =(FunctionRecord&& other)
+void MMapWrapper::SetAccessPlan(AccessPlan plan, size_t readAhead)
+{
+	m_plan = std::move(plan);
+	m_readAhead = readAhead;
+	m_advised = 0;
+}
+
+void MMapWrapper::BeginStep(size_t step)
 {
-	std::swap(name, other.name);
-	std::swap(lines, other.lines);
-	std::swap(lineCount, other.lineCount);
-	std::swap(segment, other.segment);
-	std::swap(offset, other.offset);
-	std::swap(fileIndex, other.fileIndex);
-	std::swap(length, other.length);
-	std::swap(lineOffset, other.lineOffset);
-	std::swap(typeIndex, other.typeIndex);
-	std::swap(paramSize, other.paramSize);
+	if (step >= m_plan.size())
+		return;
+
+	// The step's own pages were asked for along with the ones before it. It
+	// isn't marked sequential, which would turn off mapping the neighbours of
+	// a faulting page that are already in memory, and so only add faults.
+
+	// Ask for everything up to the read ahead limit that hasn't been asked for yet
+	size_t end = std::min(step + 1 + m_readAhead, m_plan.size());
+	for (size_t i = std::max(m_advised, step); i < end; ++i)
+		WillNeed(m_plan[i]);
 
-	return *this;
+	m_advised = std::max(m_advised, end);
 }
 
-uint32_t
-getNumPages(uint32_t length, uint32_t pageSize)
+void MMapWrapper::WillNeed(const std::vector<Range>& ranges)
 {
-	uint32_t numPages = length / pageSize;
-	if (length % pageSize)
-		numPages += 1;
+#ifdef _WIN32
+	// PrefetchVirtualMemory would do, but isn't available before Windows 8
+	(void)ranges;
+#else
+	// The decompressed file is already in memory
+	if (!Valid() || m_decompressed)
+		return;
 
-	return numPages;
+	// MSF pages can be smaller than the system's, and madvise wants aligned addresses
+	static const uint64_t sysPageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+
+	for (auto& range : ranges)
+	{
+		if (range.offset >= m_length)
+			continue;
+
+		uint64_t begin = range.offset & ~(sysPageSize - 1);
+		uint64_t end = std::min<uint64_t>(range.offset + range.size, m_length);
+		madvise(const_cast<uint8_t*>(m_base) + begin, (size_t)(end - begin), MADV_WILLNEED);
+	}
+#endif
 }
 
-class StreamReader
+bool PageCache::Open(const char* path, size_t capacity)
 {
-public:
-	StreamReader(const PDBParser::StreamPair& stream, const PDBParser& parser, uint32_t offset = 0)
-		: m_stream(stream)
-		, m_parser(parser)
-		, m_data(nullptr)
-		, m_seqPageEnd(nullptr)
-		, m_offset(0xffffffff)
-		, m_pageIndex(0xffffffff)
-		, m_pageEndIndex(0)
+	Close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+#else
+	m_fd = open(path, O_RDONLY, 0);
+#endif
+	if (!Valid())
+		return false;
+
+	m_capacity = capacity;
+	m_pageSize = 0;
+	m_hits = m_misses = 0;
+	return true;
+}
+
+void PageCache::Close()
+{
+	if (!Valid())
+		return;
+
+#ifdef _WIN32
+	CloseHandle(m_file);
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	close(m_fd);
+	m_fd = -1;
+#endif
+
+	m_pages.clear();
+	m_lru.clear();
+}
+
+void PageCache::SetPageSize(uint32_t pageSize)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	m_pageSize = pageSize;
+	m_pages.clear();
+	m_lru.clear();
+
+	// Convert the capacity to pages, but always keep at least one
+	m_capacity = std::max<size_t>(m_capacity / pageSize, 1);
+}
+
+bool PageCache::Read(uint64_t offset, void* out, size_t size) const
+{
+	uint8_t* dest = (uint8_t*)out;
+
+	while (size > 0)
 	{
-		seek(offset);
+#ifdef _WIN32
+		OVERLAPPED ov = {};
+		ov.Offset = (DWORD)offset;
+		ov.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD numRead = 0;
+		if (!ReadFile(m_file, dest, (DWORD)std::min<size_t>(size, 0x40000000), &numRead, &ov) || numRead == 0)
+			return false;
+#else
+		ssize_t numRead = pread(m_fd, dest, size, (off_t)offset);
+		if (numRead < 0 && errno == EINTR)
+			continue;
+		if (numRead <= 0)
+			return false;
+#endif
+
+		dest += numRead;
+		offset += numRead;
+		size -= numRead;
 	}
 
-	uint32_t getOffset() const { return m_offset; }
-	const uint8_t* getData() const { return m_data; };
+	return true;
+}
 
-	bool isValidOffset(uint32_t offset)
+std::shared_ptr<const uint8_t> PageCache::GetPage(uint32_t index)
+{
 	{
-		uint32_t index = offset / m_parser.pageSize();
-		return index < m_stream.pageIndices.size();
+		std::lock_guard<std::mutex> lock(m_lock);
+
+		auto iter = m_pages.find(index);
+		if (iter != m_pages.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, iter->second.lru);
+			++m_hits;
+			return iter->second.page;
+		}
+
+		++m_misses;
 	}
 
-	static const uint8_t* getData(const PDBParser::StreamPair& stream, const PDBParser& parser, uint32_t offset = 0)
+	// Don't hold the lock while waiting on the read, if another thread reads
+	// the same page in the meantime we just end up using theirs
+	auto data = std::make_shared<std::vector<uint8_t>>(m_pageSize);
+	if (!Read((uint64_t)index * m_pageSize, data->data(), m_pageSize))
+		throw std::runtime_error("Failed to read PDB page");
+
+	Page page(data, data->data());
+
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	auto iter = m_pages.find(index);
+	if (iter != m_pages.end())
+		return iter->second.page;
+
+	while (m_pages.size() >= m_capacity)
 	{
-		int index = offset / parser.pageSize();
+		m_pages.erase(m_lru.back());
+		m_lru.pop_back();
+	}
+
+	m_lru.push_front(index);
+	Entry entry = { page, m_lru.begin() };
+	m_pages.insert(std::make_pair(index, std::move(entry)));
+
+	return page;
+}
+
+struct WindowedMapping::Window
+{
+	const uint8_t*	base;
+	size_t			length;
 
-		const uint8_t* base = parser.data() + stream.pageIndices[index] * parser.pageSize();
-		base += offset % parser.pageSize();
+	Window(const uint8_t* base, size_t length)
+		: base(base)
+		, length(length)
+	{}
 
-		return base;
+	~Window()
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+#else
+		munmap(const_cast<uint8_t*>(base), length);
+#endif
 	}
+};
+
+bool WindowedMapping::Open(const char* path, size_t budget)
+{
+	Close();
 
-	void align(uint32_t align)
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
 	{
-		uint32_t diff = m_offset % align;
+		CloseHandle(file);
+		return false;
+	}
+	m_fileSize = (uint64_t)size.QuadPart;
+
+	// Views keep the mapping object alive, so the file handle isn't needed past this
+	m_mapFile = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(file);
+	if (m_mapFile == nullptr)
+		return false;
 
-		if (diff)
-			seek(m_offset + align - diff);
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	uint64_t granularity = info.dwAllocationGranularity;
+#else
+	m_fd = open(path, O_RDONLY, 0);
+	if (m_fd == -1)
+		return false;
+
+#if defined(__x86_64__)
+	struct stat st;
+	if (fstat(m_fd, &st) == -1 || st.st_size <= 0)
+#else
+	struct stat64 st;
+	if (fstat64(m_fd, &st) == -1 || st.st_size <= 0)
+#endif
+	{
+		Close();
+		return false;
 	}
+	m_fileSize = (uint64_t)st.st_size;
 
-	void seek(uint32_t offset)
+	uint64_t granularity = (uint64_t)sysconf(_SC_PAGESIZE);
+#endif
+
+	// Until the page size is known the header is all that's going to be read
+	m_granularity = granularity;
+	m_budget = budget;
+	m_pageSize = 0;
+	m_maps = 0;
+	sizeWindows(granularity);
+	return true;
+}
+
+void WindowedMapping::Close()
+{
 	{
-		uint32_t index = offset / m_parser.pageSize();
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_windows.clear();
+		m_lru.clear();
+	}
 
-		if (index == m_pageIndex)
-		{
-			if (offset > m_offset)
-				m_data += offset - m_offset;
-			else
-				m_data -= m_offset - offset;
+#ifdef _WIN32
+	if (m_mapFile)
+	{
+		CloseHandle(m_mapFile);
+		m_mapFile = nullptr;
+	}
+#else
+	if (m_fd != -1)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+#endif
+}
 
-			m_offset = offset;
-			return;
-		}
+void WindowedMapping::SetPageSize(uint32_t pageSize)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	m_windows.clear();
+	m_lru.clear();
+
+	m_pageSize = pageSize;
+	sizeWindows(std::max<uint64_t>(pageSize, m_granularity));
+}
+
+void WindowedMapping::sizeWindows(uint64_t unit)
+{
+	// A handful of windows, so that a few streams can be read at once without
+	// them taking turns evicting each other
+	const uint64_t numWindows = 8;
+
+	m_windowSize = std::max(unit, (m_budget / numWindows) & ~(unit - 1));
+	m_capacity = std::max<size_t>((size_t)(m_budget / m_windowSize), 1);
+}
+
+WindowedMapping::WindowPtr WindowedMapping::getWindow(uint64_t index)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	auto iter = m_windows.find(index);
+	if (iter != m_windows.end())
+	{
+		m_lru.splice(m_lru.begin(), m_lru, iter->second.lru);
+		return iter->second.window;
+	}
+
+	uint64_t offset = index * m_windowSize;
+	if (offset >= m_fileSize)
+		throw std::runtime_error("Reading past the end of the PDB file");
+
+	size_t length = (size_t)std::min(m_windowSize, m_fileSize - offset);
+
+#ifdef _WIN32
+	const uint8_t* base = (const uint8_t*)MapViewOfFile(m_mapFile, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, length);
+	if (base == nullptr)
+		throw std::runtime_error("Failed to map a window of the PDB file");
+#else
+#if defined(__x86_64__)
+	void* data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, m_fd, (off_t)offset);
+#else
+	void* data = mmap64(NULL, length, PROT_READ, MAP_PRIVATE, m_fd, (off64_t)offset);
+#endif
+	if (data == MAP_FAILED)
+		throw std::runtime_error("Failed to map a window of the PDB file");
+	const uint8_t* base = (const uint8_t*)data;
+#endif
+
+	++m_maps;
+	WindowPtr window = std::make_shared<const Window>(base, length);
+
+	// Anything evicted while it's still pinned stays mapped until it's let go of
+	while (m_windows.size() >= m_capacity)
+	{
+		m_windows.erase(m_lru.back());
+		m_lru.pop_back();
+	}
+
+	m_lru.push_front(index);
+	Entry entry = { window, m_lru.begin() };
+	m_windows.insert(std::make_pair(index, std::move(entry)));
+
+	return window;
+}
+
+const uint8_t* WindowedMapping::GetPages(uint32_t page, uint32_t& count, std::shared_ptr<const void>& pin)
+{
+	uint64_t offset = (uint64_t)page * m_pageSize;
+	WindowPtr window = getWindow(offset / m_windowSize);
+	size_t inWindow = (size_t)(offset % m_windowSize);
+
+	if (window->length - inWindow < m_pageSize)
+		throw std::runtime_error("Reading past the end of the PDB file");
+
+	// Windows are a whole number of pages, so none are ever split between two
+	count = std::min(count, (uint32_t)((window->length - inWindow) / m_pageSize));
+	pin = window;
+	return window->base + inWindow;
+}
+
+bool WindowedMapping::Read(uint64_t offset, void* out, size_t size)
+{
+	uint8_t* dest = (uint8_t*)out;
+
+	while (size > 0)
+	{
+		if (offset >= m_fileSize)
+			return false;
+
+		WindowPtr window = getWindow(offset / m_windowSize);
+		size_t inWindow = (size_t)(offset % m_windowSize);
+		size_t toCopy = std::min(size, window->length - inWindow);
+
+		memcpy(dest, window->base + inWindow, toCopy);
+		dest += toCopy;
+		offset += toCopy;
+		size -= toCopy;
+	}
+
+	return true;
+}
+
+bool PipeReader::Open(int fd)
+{
+	Close();
+
+	if (fd < 0)
+		return false;
+
+	m_fd = fd;
+	m_pages.clear();
+	m_keep.clear();
+	m_pageSize = 0;
+	m_received = 0;
+	m_done = false;
+	m_failed = false;
+
+	m_thread = std::thread([this] { readPages(); });
+	return true;
+}
+
+void PipeReader::Close()
+{
+	if (!Valid())
+		return;
+
+	// Nothing more needs to be kept, the rest of the input is just drained
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_keep.assign(1, false);
+		m_pages.clear();
+	}
+
+	m_thread.join();
+	m_fd = -1;
+}
+
+bool PipeReader::readAll(uint8_t* out, size_t size)
+{
+	while (size > 0)
+	{
+#ifdef _WIN32
+		int numRead = _read(m_fd, out, (unsigned)std::min<size_t>(size, 0x40000000));
+#else
+		ssize_t numRead = read(m_fd, out, size);
+		if (numRead < 0 && errno == EINTR)
+			continue;
+#endif
+		if (numRead <= 0)
+			return false;
 
-		if (index >= m_stream.pageIndices.size())
-			throw std::runtime_error("Requesting offset outside of page range");
+		out += numRead;
+		size -= numRead;
+	}
+
+	return true;
+}
 
-		const uint8_t* base = m_parser.data() + m_stream.pageIndices[index] * m_parser.pageSize();
-		m_data = base + offset % m_parser.pageSize();
-		m_offset = offset;
-		m_pageIndex = index;
+void PipeReader::readPages()
+{
+	PDBHeader header;
+	bool ok = readAll((uint8_t*)&header, sizeof(header));
 
-		/*if (m_pageIndex < m_pageEndIndex)
-		return;*/
+	// Anything that isn't a sane page size means this isn't an MSF at all
+	uint32_t pageSize = header.pageSize;
+	if (!ok || pageSize < sizeof(header) || pageSize > 0x10000 || (pageSize & (pageSize - 1)) != 0)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_done = m_failed = true;
+		m_arrived.notify_all();
+		return;
+	}
 
-		// Check to see if we have any non-adjacent pages
-		size_t count = m_stream.pageIndices.size();
-		size_t last = count - 1;
-		if (index == last)
+	Page page = std::make_shared<std::vector<uint8_t>>(pageSize);
+	memcpy(page->data(), &header, sizeof(header));
+	ok = readAll(page->data() + sizeof(header), pageSize - sizeof(header));
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_pageSize = pageSize;
+	}
+
+	std::vector<uint8_t> scratch(pageSize);
+
+	while (ok)
+	{
 		{
-			m_seqPageEnd = base + m_parser.pageSize();
-			m_pageEndIndex = (uint32_t)last;
+			std::lock_guard<std::mutex> lock(m_lock);
 
-			assert(m_seqPageEnd > m_data);
-			return;
+			if (m_keep.empty() || (m_received < m_keep.size() && m_keep[m_received]))
+				m_pages.push_back(std::move(page));
+			else
+				m_pages.push_back(nullptr);
+
+			++m_received;
 		}
-		else
+		m_arrived.notify_all();
+
+		// Pages that aren't going to be kept don't need memory of their own
+		bool keep;
 		{
-			// Scan forward to find the first non-adjacent page
-			uint32_t expected = m_stream.pageIndices[index] + 1;
-			for (size_t i = index + 1; i < count; ++i)
-			{
-				if (expected++ != m_stream.pageIndices[i])
-				{
-					m_seqPageEnd = m_parser.data() + m_stream.pageIndices[i - 1] * m_parser.pageSize() + m_parser.pageSize();
-					m_pageEndIndex = (uint32_t)i - 1;
+			std::lock_guard<std::mutex> lock(m_lock);
+			keep = m_keep.empty() || (m_received < m_keep.size() && m_keep[m_received]);
+		}
 
-					assert(m_seqPageEnd > m_data);
-					return;
-				}
-			}
+		if (keep)
+		{
+			page = std::make_shared<std::vector<uint8_t>>(pageSize);
+			ok = readAll(page->data(), pageSize);
 		}
+		else
+		{
+			page.reset();
+			ok = readAll(scratch.data(), pageSize);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_done = true;
+	m_arrived.notify_all();
+}
+
+bool PipeReader::waitFor(uint32_t index, std::unique_lock<std::mutex>& lock) const
+{
+	m_arrived.wait(lock, [this, index] { return m_received > index || m_done; });
+	return m_received > index;
+}
+
+bool PipeReader::Read(uint64_t offset, void* out, size_t size) const
+{
+	uint8_t* dest = (uint8_t*)out;
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	m_arrived.wait(lock, [this] { return m_pageSize != 0 || m_done; });
+	if (m_pageSize == 0)
+		return false;
+
+	while (size > 0)
+	{
+		uint32_t index = (uint32_t)(offset / m_pageSize);
+		uint32_t pageOffset = (uint32_t)(offset % m_pageSize);
+		size_t toCopy = std::min<size_t>(size, m_pageSize - pageOffset);
+
+		if (!waitFor(index, lock) || !m_pages[index])
+			return false;
+
+		memcpy(dest, m_pages[index]->data() + pageOffset, toCopy);
+		dest += toCopy;
+		offset += toCopy;
+		size -= toCopy;
+	}
 
-		m_seqPageEnd = m_parser.data() + m_stream.pageIndices[last] * m_parser.pageSize() + m_parser.pageSize();
-		m_pageEndIndex = (uint32_t)last;
+	return true;
+}
+
+std::shared_ptr<const uint8_t> PipeReader::GetPage(uint32_t index) const
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	if (!waitFor(index, lock))
+		throw std::runtime_error("The PDB ended before all of its pages were read");
+
+	const Page& page = m_pages[index];
+	if (!page)
+		throw std::runtime_error("Reading a PDB page that was not kept");
+
+	return std::shared_ptr<const uint8_t>(page, page->data());
+}
 
-		assert(m_seqPageEnd > m_data);
+void PipeReader::Retain(const std::vector<bool>& pages)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	m_keep = pages;
+	// An empty set would mean keeping everything
+	if (m_keep.empty())
+		m_keep.push_back(false);
+
+	for (size_t i = 0; i < m_pages.size(); ++i)
+	{
+		if (i >= m_keep.size() || !m_keep[i])
+			m_pages[i].reset();
 	}
+}
+
+uint32_t PipeReader::PagesReceived() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_received;
+}
+
+uint32_t PipeReader::PagesKept() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return (uint32_t)std::count_if(m_pages.begin(), m_pages.end(), [](const Page& page) { return page != nullptr; });
+}
 
-	template<typename T>
-	T peek()
+namespace
+{
+// Eight bytes at a time, each mixed in with a multiply. Names are often
+// hundreds of bytes long, so this has to be quick rather than perfect.
+uint64_t hashString(const char* str, size_t length)
+{
+	const uint64_t k = 0x9E3779B97F4A7C15ull;
+	uint64_t h = length * k;
+
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8)
 	{
-		// Verify!
-		if (m_data + sizeof(T) > m_seqPageEnd)
-		{
-			uint32_t offset = m_offset;
+		uint64_t word;
+		memcpy(&word, str + i, 8);
+		h = (h ^ word) * k;
+		h ^= h >> 29;
+	}
 
-			T retValue;
-			uint8_t* outVal = (uint8_t*)&retValue;
-			uint32_t toRead = sizeof(T);
+	uint64_t tail = 0;
+	memcpy(&tail, str + i, length - i);
+	h = (h ^ tail) * k;
 
-			while (toRead > 0)
-			{
-				uint32_t seqRead = std::min((uint32_t)(m_seqPageEnd - m_data), toRead);
+	h ^= h >> 32;
+	h *= k;
+	h ^= h >> 29;
+	return h;
+}
+}
 
-				// Hack
-				if (seqRead == 0)
-				{
-					--m_offset;
-					seek(m_offset + 1);
-				}
+StringPool::String StringPool::intern(const char* str, size_t length, bool copy)
+{
+	++m_lookups;
 
-				memcpy(outVal, m_data, seqRead);
+	uint64_t hash = hashString(str, length);
+	uint32_t index = (uint32_t)(hash >> (64 - ShardBits));
+	Shard& shard = m_shards[index];
 
-				seek(m_offset + seqRead);
+	std::lock_guard<std::mutex> lock(shard.lock);
 
-				toRead -= seqRead;
-				outVal += seqRead;
-			}
+	// Never more than half full, so there's always a free slot to stop at
+	if ((shard.count + 1) * 2 > shard.slots.size())
+		grow(shard);
 
-			// Return back to the original position
-			seek(offset);
+	size_t mask = shard.slots.size() - 1;
+	size_t slot = (uint32_t)hash & mask;
+	for (;; slot = (slot + 1) & mask)
+	{
+		const Entry& entry = shard.slots[slot];
+		if (!entry.data)
+			break;
 
-			return retValue;
+		if (entry.hash == (uint32_t)hash && entry.length == length && memcmp(entry.data, str, length) == 0)
+		{
+			String found = { entry.data, entry.id };
+			return found;
 		}
-		else
-			return *((const T*)m_data);
 	}
 
-	template<typename T>
-	DataPtr<T> read(uint32_t size = 0)
+	if (copy)
 	{
-		uint32_t toRead = size == 0 ? sizeof(T) : size;
+		char* copied = (char*)shard.arena.allocate(length + 1);
+		memcpy(copied, str, length);
+		copied[length] = 0;
+		str = copied;
+	}
 
-		// Check to see if the data is split across multiple pages
-		if (m_data + toRead > m_seqPageEnd)
-		{
-			uint8_t* alloced = (uint8_t*)malloc(toRead);
-			uint8_t* outPos = alloced;
+	// The shard is in the low bits so that ids are unique across shards
+	Entry entry = { str, (uint32_t)length, (uint32_t)hash, (shard.count++ << ShardBits) | index };
+	shard.slots[slot] = entry;
 
-			while (toRead > 0)
-			{
-				uint32_t seqRead = std::min((uint32_t)(m_seqPageEnd - m_data), toRead);
+	String added = { entry.data, entry.id };
+	return added;
+}
 
-				// Hack
-				if (seqRead == 0)
-				{
-					--m_offset;
-					seek(m_offset + 1);
-				}
+void StringPool::grow(Shard& shard)
+{
+	std::vector<Entry> slots(std::max<size_t>(shard.slots.size() * 2, 256));
+	size_t mask = slots.size() - 1;
+
+	for (auto& entry : shard.slots)
+	{
+		if (!entry.data)
+			continue;
+
+		size_t slot = entry.hash & mask;
+		while (slots[slot].data)
+			slot = (slot + 1) & mask;
+		slots[slot] = entry;
+	}
+
+	shard.slots.swap(slots);
+}
+
+void StringPool::reset()
+{
+	for (auto& shard : m_shards)
+	{
+		std::fill(shard.slots.begin(), shard.slots.end(), Entry());
+		shard.count = 0;
+		shard.arena.reset();
+	}
+	m_lookups = 0;
+}
+
+void StringPool::setCounter(std::atomic<uint64_t>* counter)
+{
+	for (auto& shard : m_shards)
+		shard.arena.setCounter(counter);
+}
+
+uint64_t StringPool::Strings() const
+{
+	uint64_t strings = 0;
+	for (auto& shard : m_shards)
+	{
+		std::lock_guard<std::mutex> lock(shard.lock);
+		strings += shard.count;
+	}
+	return strings;
+}
 
-				memcpy(outPos, m_data, seqRead);
+uint32_t
+getNumPages(uint32_t length, uint32_t pageSize)
+{
+	uint32_t numPages = length / pageSize;
+	if (length % pageSize)
+		numPages += 1;
 
-				seek(m_offset + seqRead);
+	return numPages;
+}
 
-				toRead -= seqRead;
-				outPos += seqRead;
-			}
+void
+PDBParser::load(const char* path)
+{
+	m_path = path;
 
-			return DataPtr<T>(alloced, true);
-		}
-		else
-		{
-			DataPtr<T> read(m_data);
+	bool compressed = MMapWrapper::IsCompressed(path);
+	if (compressed && m_pageCacheSize)
+		fprintf(stderr, "Warning: compressed PDBs are decompressed into memory, not read through the page cache\n");
+	else if (compressed && m_windowBudget)
+		fprintf(stderr, "Warning: compressed PDBs are decompressed into memory, not mapped through windows\n");
 
-			m_data += toRead;
-			m_offset += toRead;
+	if (m_pageCacheSize && !compressed)
+	{
+		if (!m_pageCache.Open(path, m_pageCacheSize))
+			throw std::runtime_error("Failed to load PDB file");
+	}
+	else if (m_windowBudget && !compressed)
+	{
+		if (!m_windows.Open(path, m_windowBudget))
+			throw std::runtime_error("Failed to load PDB file");
+	}
+	else if (m_mapping.Map(path))
+		m_base = m_mapping.base();
+	else
+	{
+		// Most likely there isn't enough address space for all of it, which
+		// is easy to run out of in a 32 bit process
+		const size_t fallbackBudget = 256 << 20;
+		if (compressed || !m_windows.Open(path, fallbackBudget))
+			throw std::runtime_error("Failed to load PDB file");
 
-			return read;
-		}
+		fprintf(stderr, "Warning: failed to map the whole PDB, mapping it through windows instead\n");
 	}
 
-	DataPtr<char> readString()
+	if (!compressed)
 	{
-		uint32_t origOffset = m_offset;
-		const uint8_t* toCopy = m_data;
-		uint32_t strLen = 0;
-		bool needsSeek = false;
+		loadHeaders(path);
+		return;
+	}
 
-		do
+	// The compression suffix isn't part of the PDB's name
+	std::string name(path);
+	const char* suffixes[] = { ".gz", ".zst", ".zstd" };
+	for (auto suffix : suffixes)
+	{
+		size_t len = strlen(suffix);
+		if (name.size() > len && strcasecmp(name.c_str() + name.size() - len, suffix) == 0)
 		{
-			if (toCopy == m_seqPageEnd)
-			{
-				needsSeek = true;
-				seek(m_offset + strLen + 1);
-				toCopy = m_data - 1;
-			}
-
-			if (*toCopy++ == 0)
-			{
-				if (needsSeek)
-					seek(origOffset);
-
-				return read<char>(strLen + 1);
-			}
-
-			++strLen;
-		} while(true);
+			name.erase(name.size() - len);
+			break;
+		}
 	}
 
-private:
-
-	const PDBParser::StreamPair&	m_stream;
-	const PDBParser&				m_parser;
-
-	const uint8_t*					m_data;
-	const uint8_t*					m_seqPageEnd;
-	uint32_t						m_offset;
-	uint32_t						m_pageIndex;
-	uint32_t						m_pageEndIndex;
-};
+	loadHeaders(name.c_str());
+}
 
 void
-PDBParser::load(const char* path)
+PDBParser::load(int fd, const char* name)
 {
-	if (!m_mapping.Map(path))
+	// There is no file for the prefetcher to read ahead in
+	m_path.clear();
+
+	if (!m_pipe.Open(fd))
 		throw std::runtime_error("Failed to load PDB file");
 
-	m_base = m_mapping.base();
+	loadHeaders(name);
+}
 
+void
+PDBParser::loadHeaders(const char* path)
+{
 	if (!readRootStream())
 		throw std::runtime_error("Failed to read PDB Root Stream");
 
@@ -500,66 +1338,115 @@ PDBParser::load(const char* path)
 	}
 }
 
+const uint8_t*
+PDBParser::getPages(uint32_t page, uint32_t& count, std::shared_ptr<const void>& pin) const
+{
+	if (m_base)
+	{
+		pin.reset();
+		return m_base + (size_t)page * m_pageSize;
+	}
+
+	if (m_windows.Valid())
+		return m_windows.GetPages(page, count, pin);
+
+	// Cached pages are not adjacent to each other, and neither are piped ones
+	auto cached = m_pipe.Valid() ? m_pipe.GetPage(page) : m_pageCache.GetPage(page);
+	count = 1;
+	pin = cached;
+	return cached.get();
+}
+
+void
+PDBParser::readFile(uint64_t offset, void* out, size_t size) const
+{
+	if (m_base)
+		memcpy(out, m_base + offset, size);
+	else if (m_windows.Valid())
+	{
+		if (!m_windows.Read(offset, out, size))
+			throw std::runtime_error("Failed to read from PDB file");
+	}
+	else if (m_pipe.Valid())
+	{
+		if (!m_pipe.Read(offset, out, size))
+			throw std::runtime_error("Failed to read from PDB pipe");
+	}
+	else if (!m_pageCache.Read(offset, out, size))
+		throw std::runtime_error("Failed to read from PDB file");
+}
+
 bool
 PDBParser::readRootStream()
 {
-	const PDBHeader* header = (const PDBHeader*)m_base;
+	PDBHeader header;
+	readFile(0, &header, sizeof(header));
+
 	const char validSignature[] = {"Microsoft C/C++ MSF 7.00\r\n\032DS\0\0"};
 
-	if (memcmp(header->signature, validSignature, sizeof(validSignature)) != 0)
+	if (memcmp(header.signature, validSignature, sizeof(validSignature)) != 0)
 	{
 		fprintf(stderr, "Input file has an invalid signature\n");
 		return false;
 	}
 
-	m_pageSize = header->pageSize;
-	m_numPages = header->pagesUsed;
+	// Big MSFs use pages of up to 32KB, anything past that can't be an MSF
+	if (header.pageSize < 512 || header.pageSize > 0x10000 || (header.pageSize & (header.pageSize - 1)) != 0)
+	{
+		fprintf(stderr, "Input file has an invalid page size\n");
+		return false;
+	}
+
+	m_pageSize = header.pageSize;
+	m_numPages = header.pagesUsed;
+
+	if (m_pageCache.Valid())
+		m_pageCache.SetPageSize(m_pageSize);
+	if (m_windows.Valid())
+		m_windows.SetPageSize(m_pageSize);
 
-	uint32_t rootSize = header->directorySize;
+	uint32_t rootSize = header.directorySize;
 	uint32_t numRootPages = getNumPages(rootSize, m_pageSize);
 	uint32_t numRootIndexPages = getNumPages(numRootPages * 4, m_pageSize);
 
-	const uint32_t* rootIndices = (const uint32_t*)(m_base + sizeof(PDBHeader));
-	std::vector<uint32_t> rootPageList;
-	for (uint32_t i = 0; i < numRootIndexPages; ++i) {
-		const uint32_t* rootPages = (const uint32_t*)(m_base + rootIndices[i] * m_pageSize);
-		rootPageList.insert(rootPageList.end(), rootPages, rootPages + (m_pageSize / sizeof(uint32_t)));
-	}
+	const uint32_t numItems = m_pageSize / sizeof(uint32_t);
+
+	// The pages of the directory are listed in the root index pages, which are
+	// in turn listed right after the header
+	std::vector<uint32_t> rootIndices(numRootIndexPages);
+	readFile(sizeof(PDBHeader), rootIndices.data(), numRootIndexPages * sizeof(uint32_t));
+
+	std::vector<uint32_t> rootPageList(numRootIndexPages * numItems);
+	for (uint32_t i = 0; i < numRootIndexPages; ++i)
+		readFile((uint64_t)rootIndices[i] * m_pageSize, rootPageList.data() + i * numItems, m_pageSize);
 
-	uint32_t pageIndex = 0;
-	uint32_t pageOffset = 0;
-	const uint32_t* page = (const uint32_t*)(m_base + rootPageList[pageIndex] * m_pageSize);
+	// Gather the whole directory into one block
+	std::vector<uint32_t> directory(numRootPages * numItems);
+	for (uint32_t i = 0; i < numRootPages; ++i)
+		readFile((uint64_t)rootPageList[i] * m_pageSize, directory.data() + i * numItems, std::min(m_pageSize, rootSize - i * m_pageSize));
+
+	const uint32_t* dir = directory.data();
+	const uint32_t* dirEnd = dir + rootSize / sizeof(uint32_t);
 
 	// The first 4 bytes are how many streams we actually need to read
-	uint32_t numStreams = *page;
-	++pageOffset;
+	if (dir == dirEnd)
+		return false;
 
-	m_streams.reserve(numStreams);
+	uint32_t numStreams = *dir++;
+	if (numStreams > (uint32_t)(dirEnd - dir))
+		return false;
 
-	const uint32_t numItems = m_pageSize / sizeof(uint32_t);
+	m_streams.reserve(numStreams);
 
 	// Read all of the sizes for each stream, which directly determines how many
 	// page indices we need to read after them
+	for (uint32_t i = 0; i < numStreams; ++i)
 	{
-		uint32_t streamIndex = 0;
-		do
-		{
-			for (; streamIndex < numStreams && pageOffset < numItems; ++streamIndex, ++pageOffset)
-			{
-				uint32_t size = page[pageOffset];
-				if (size == 0xFFFFFFFF)
-					m_streams.push_back(StreamPair(0));
-				else
-					m_streams.push_back(StreamPair(size));
-			}
-
-			// Advance to the next page
-			if (pageOffset == numItems)
-			{
-				page = (const uint32_t*)(m_base + rootPageList[++pageIndex] * m_pageSize);
-				pageOffset = 0;
-			}
-		} while (streamIndex < numStreams);
+		uint32_t size = *dir++;
+		if (size == 0xFFFFFFFF)
+			m_streams.push_back(StreamPair(0));
+		else
+			m_streams.push_back(StreamPair(size));
 	}
 
 	// For each stream, get the list of page indices associated with each one,
@@ -570,22 +1457,13 @@ PDBParser::readRootStream()
 
 		if (numPages != 0)
 		{
-			m_streams[i].pageIndices.resize(numPages);
+			if (numPages > (uint32_t)(dirEnd - dir))
+				return false;
 
-			uint32_t numToCopy = numPages;
-			do
-			{
-				uint32_t num = std::min(numToCopy, numItems - pageOffset);
-				memcpy(m_streams[i].pageIndices.data() + numPages - numToCopy, page + pageOffset, sizeof(uint32_t) * num);
-				numToCopy -= num;
-				pageOffset += num;
+			m_streams[i].pageIndices.assign(dir, dir + numPages);
+			dir += numPages;
 
-				if (pageOffset == numItems)
-				{
-					page = (const uint32_t*)(m_base + rootPageList[++pageIndex] * m_pageSize);
-					pageOffset = 0;
-				}
-			} while (numToCopy);
+			buildPageRuns(m_streams[i]);
 		}
 	}
 
@@ -651,6 +1529,134 @@ PDBParser::readRootStream()
 	return numOk == 0;
 }
 
+void
+PDBParser::buildPageRuns(StreamPair& stream)
+{
+	uint32_t count = (uint32_t)stream.pageIndices.size();
+
+	stream.runs.clear();
+	stream.pageRuns.resize(count);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t page = stream.pageIndices[i];
+
+		if (!stream.runs.empty())
+		{
+			PageRun& last = stream.runs.back();
+			if (last.page + last.size / m_pageSize == page)
+			{
+				last.size += m_pageSize;
+				stream.pageRuns[i] = (uint32_t)stream.runs.size() - 1;
+				continue;
+			}
+		}
+
+		PageRun run = { i * m_pageSize, m_pageSize, page };
+		stream.pageRuns[i] = (uint32_t)stream.runs.size();
+		stream.runs.push_back(run);
+	}
+}
+
+StreamView
+PDBParser::getStreamView(uint32_t index)
+{
+	const StreamPair& stream = getStream(index);
+
+	if (stream.runs.empty())
+		return StreamView();
+
+	// No need to copy anything if the pages are all adjacent
+	if (m_base && stream.runs.size() == 1)
+		return StreamView(m_base + (size_t)stream.runs[0].page * m_pageSize, stream.size);
+
+	std::lock_guard<std::mutex> lock(m_streamCopyLock);
+
+	auto& copy = m_streamCopies[index];
+	if (!copy)
+	{
+		copy = std::make_shared<std::vector<uint8_t>>(stream.size);
+		m_bytesAllocated += stream.size;
+
+		for (auto& run : stream.runs)
+			readFile((uint64_t)run.page * m_pageSize, copy->data() + run.offset, std::min(run.size, stream.size - run.offset));
+	}
+
+	return StreamView(copy->data(), stream.size, copy);
+}
+
+StreamReader
+PDBParser::openStream(uint32_t index, Arena* arena)
+{
+	if (m_base)
+		return StreamReader(getStreamView(index));
+
+	return StreamReader(getStream(index), *this, 0, arena);
+}
+
+std::vector<MMapWrapper::Range>
+PDBParser::getStreamRanges(int32_t index) const
+{
+	std::vector<MMapWrapper::Range> ranges;
+	if (index < 0 || (size_t)index >= m_streams.size())
+		return ranges;
+
+	const StreamPair& stream = m_streams[index];
+	for (auto& run : stream.runs)
+	{
+		MMapWrapper::Range range = { (uint64_t)run.page * m_pageSize, std::min(run.size, stream.size - run.offset) };
+		ranges.push_back(range);
+	}
+
+	return ranges;
+}
+
+void
+PDBParser::retainStreams(const std::vector<int32_t>& streams)
+{
+	std::vector<bool> pages(m_numPages, false);
+	for (auto index : streams)
+	{
+		if (index < 0 || (size_t)index >= m_streams.size())
+			continue;
+
+		for (auto page : m_streams[index].pageIndices)
+		{
+			if (page >= pages.size())
+				pages.resize(page + 1, false);
+			pages[page] = true;
+		}
+	}
+
+	m_pipe.Retain(pages);
+}
+
+void
+PDBParser::beginStep(size_t step)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_stepLock);
+		m_mapping.BeginStep(step);
+	}
+
+	// Waits for the step's reads, which is done outside the lock so that
+	// other modules can be decoded meanwhile. The prefetcher has its own.
+	if (m_prefetcher)
+		m_prefetcher->BeginStep(step);
+}
+
+Arena*
+PDBParser::taskArena(size_t task)
+{
+	while (m_taskArenas.size() <= task)
+	{
+		m_taskArenas.emplace_back(new Arena);
+		m_taskArenas.back()->setCounter(&m_bytesAllocated);
+	}
+
+	return arena(*m_taskArenas[task]);
+}
+
 void
 PDBParser::loadNameStream(NameStream& names)
 {
@@ -668,33 +1674,22 @@ PDBParser::loadNameStream(NameStream& names)
 		int32_t  offset;
 	};
 
-	auto& ns = getStream(nIter->second);
-
-	// Die in a fire microsoft.
-	// Explanation - Every pdb I have tested puts streams in sequential order
-	// so I assumed that was always the case, but no, apparently incorrect!
-	// This was only encountered in one PDB in this one stream, so for now, just do this once.
-	// Obviously the way to always be 100% correct all the time is to copy the entire stream into sequential
-	// memory, but we don't want to do that if we don't have to
-	char* tempData = new char[ns.size];
-	names.buffer = tempData;
-
-	uint32_t last = (uint32_t)ns.pageIndices.size() - 1;
-	for (uint32_t i = 0, end = last; i < end; ++i)
-		memcpy(tempData + i * m_pageSize, m_base + ns.pageIndices[i] * m_pageSize, m_pageSize);
-
-	// The last page may be shorter than the actual page size
-	memcpy(tempData + last * m_pageSize, m_base + ns.pageIndices[last] * m_pageSize, std::min(m_pageSize, ns.size - last * m_pageSize));
+	// Not every PDB keeps this stream's pages in sequential order, in which case
+	// the view is a copy, otherwise the names are used straight from the mapping
+	names.view = getStreamView(nIter->second);
+	if (names.view.size() < sizeof(NameStreamHeader))
+		throw std::runtime_error("Invalid name stream");
 
-	const NameStreamHeader* nsh = (NameStreamHeader*)tempData;
+	const char* data = (const char*)names.view.data();
+	const NameStreamHeader* nsh = (const NameStreamHeader*)data;
 
 	if (nsh->sig != 0xeffeeffe || nsh->version != 1)
 		throw std::runtime_error("Invalid name stream");
 
-	const uint32_t* offsets = (uint32_t*)(tempData + sizeof(NameStreamHeader) + nsh->offset);
+	const uint32_t* offsets = (const uint32_t*)(data + sizeof(NameStreamHeader) + nsh->offset);
 	uint32_t size = *offsets++;
 
-	const char* nameStart = tempData + sizeof(NameStreamHeader);
+	const char* nameStart = data + sizeof(NameStreamHeader);
 
 	for (uint32_t i = 0; i < size; ++i)
 	{
@@ -708,23 +1703,148 @@ PDBParser::loadNameStream(NameStream& names)
 	}
 }
 
-PDBParser::TypeMap
-PDBParser::loadTypeStream()
+void
+PDBParser::loadTypeStream(TypeTable& table)
 {
-	auto& ts = getStream(TypeInfoStream);
-	if (ts.size == 0)
+	if (getStream(TypeInfoStream).size == 0)
 		throw std::runtime_error("Invalid type info stream");
 
-	StreamReader reader(ts, *this);
+	// Types are read where they are when the file is mapped. Otherwise each
+	// record is read through the pages of the stream as it's needed, rather
+	// than copying the whole stream out of the cache or the pipe.
+	auto tih = openStream(TypeInfoStream).read<TypeInfoHeader>();
+	if (m_base)
+		table.reset(getStreamView(TypeInfoStream), tih->min, tih->max);
+	else
+		table.reset(getStream(TypeInfoStream), *this, tih->min, tih->max);
+
+	StreamReader reader = table.reader();
+	reader.seek(sizeof(TypeInfoHeader));
+	uint32_t start = reader.getOffset();
+
+	// Every block between the offsets in the hash stream is decoded the
+	// first time a type in it is looked up, on whatever thread does that
+	if (m_lazyTypes)
+	{
+		auto blocks = getTypeOffsets(*tih.data, start);
+		if (!blocks.empty())
+		{
+			TypeTable* t = &table;
+			table.setLazy(std::move(blocks), [this, t, start](size_t block) { decodeTypeBlock(*t, block, start); });
+			return;
+		}
+	}
+
+	// Chunks of the stream are decoded at the same time when there are enough
+	// threads for it, and if the chunks don't line up with each other the
+	// whole stream is decoded in one go instead
+	size_t tasks = Concurrency::GetProcessorCount();
+	auto chunks = tasks > 1 ? getTypeChunks(*tih.data, start, tasks * 4) : std::vector<TypeChunk>();
+	if (chunks.size() > 1)
+	{
+		struct Result
+		{
+			uint32_t	stop;	//!< The type it stopped at
+			uint32_t	end;
+			bool		failed;
+			bool		exceeded;
+		};
+
+		std::vector<Result> results(chunks.size());
+
+		// Every chunk fills in its own part of the table
+		Concurrency::task_group tg;
+		for (size_t c = 0; c < chunks.size(); ++c)
+		{
+			tg.run([this, c, &chunks, &results, &tih, &table]() {
+				auto& result = results[c];
+				uint32_t last = c + 1 < chunks.size() ? chunks[c + 1].first : tih->max;
+
+				result.stop = chunks[c].first;
+				result.end = chunks[c].offset;
+				result.failed = false;
+				result.exceeded = false;
+				try
+				{
+					StreamReader chunkReader = table.reader();
+					result.stop = readTypes(chunkReader, chunks[c].first, last, result.end, table);
+				}
+				catch (BudgetExceeded&)
+				{
+					// Like a record without a type, nothing after it is used
+					result.exceeded = true;
+				}
+				catch (std::exception&)
+				{
+					// Might be past a record that would have stopped the serial
+					// loader from ever getting here, so let it decide
+					result.failed = true;
+				}
+			});
+		}
+		tg.wait();
+
+		if (!truncating())
+		{
+			for (auto& result : results)
+			{
+				if (result.exceeded)
+					throw BudgetExceeded(m_budgetReason.load());
+			}
+		}
+
+		bool lined = true;
+		for (size_t c = 0; c < results.size() && lined; ++c)
+		{
+			uint32_t last = c + 1 < chunks.size() ? chunks[c + 1].first : tih->max;
+
+			if (results[c].failed)
+				lined = false;
+			// The types it got through are kept, but none after them
+			else if (results[c].exceeded)
+			{
+				table.clear(last, tih->max);
+				break;
+			}
+			// Nothing after a record without a type is used
+			else if (results[c].stop != last)
+			{
+				table.clear(results[c].stop, tih->max);
+				break;
+			}
+			// Records are aligned, so the next one starts at the next multiple of 4
+			else if (c + 1 < results.size() && ((results[c].end + 3) & ~3u) != chunks[c + 1].offset)
+				lined = false;
+		}
+
+		if (lined)
+			return;
+
+		table.reset(tih->min, tih->max);
+	}
 
-	auto tih = reader.read<TypeInfoHeader>();
+	uint32_t end = start;
+	try
+	{
+		readTypes(reader, tih->min, tih->max, end, table);
+	}
+	catch (BudgetExceeded&)
+	{
+		if (!truncating())
+			throw;
+	}
+}
 
-	TypeMap map;
-	map.reserve(tih->max - tih->min);
-	uint32_t end = reader.getOffset();
+uint32_t
+PDBParser::readTypes(StreamReader& reader, uint32_t first, uint32_t last, uint32_t& offset, TypeTable& table)
+{
+	uint32_t end = offset;
 
-	for (uint32_t i = tih->min; i < tih->max; ++i)
+	for (uint32_t i = first; i < last; ++i)
 	{
+		if (((i - first) & 255) == 0)
+			checkBudget();
+
 		reader.seek(end);
 		reader.align(sizeof(TypeRecord));
 
@@ -732,86 +1852,283 @@ PDBParser::loadTypeStream()
 		if (tr->length == 0)
 			throw std::runtime_error("Invalid type info stream");
 
-		// No type, which can happen rarely, do NOT adjust when encountered
+		// No type, which can happen rarely, do NOT adjust when encountered.
+		// Every type after it ends up reading the same record again, so none
+		// of them are found either.
 		if (tr->leafType == 0)
-			continue;
+		{
+			table.addDecoded(i - first);
+			return i;
+		}
 
 		end = reader.getOffset() + tr->length - sizeof(uint16_t);
+		offset = end;
 
+		// The record is only checked to be all in the stream, which reading it
+		// would do by copying it out whenever its page can't be pointed into
 		TypeInfo nfo;
-		nfo.type = (LEAF::Enum)tr->leafType;
+		nfo.type = tr->leafType;
+		nfo.offset = reader.getOffset();
+		uint32_t pos = nfo.offset;
+		uint32_t size = 0;
 
 		switch (tr->leafType)
 		{
 		case LEAF::LF_MODIFIER:
-			nfo.data = reader.read<uint8_t>(sizeof(LeafModifier));
+			size = sizeof(LeafModifier);
 			break;
 		case LEAF::LF_POINTER:
-			nfo.data = reader.read<uint8_t>(sizeof(LeafPointer));
+			size = sizeof(LeafPointer);
 			break;
 		case LEAF::LF_PROCEDURE:
-			nfo.data = reader.read<uint8_t>(sizeof(LeafProc));
+			size = sizeof(LeafProc);
 			break;
 		case LEAF::LF_MFUNCTION:
-			nfo.data = reader.read<uint8_t>(sizeof(LeafMFunc));
+			size = sizeof(LeafMFunc);
 			break;
 		case LEAF::LF_ARGLIST:
-			{
-				uint32_t count = reader.peek<uint32_t>();
-				nfo.data = reader.read<uint8_t>((count + 1) * sizeof(uint32_t));
-			}
+			size = (reader.peek<uint32_t>() + 1) * sizeof(uint32_t);
 			break;
 		case LEAF::LF_ARRAY:
-			nfo.data = reader.read<uint8_t>(sizeof(LeafArray));
+			size = sizeof(LeafArray);
 			break;
 		case LEAF::LF_CLASS:
 		case LEAF::LF_STRUCTURE:
 			{
 				reader.seek(reader.getOffset() + sizeof(LeafClass) + sizeof(uint16_t));
-				nfo.name = reader.readString();
+				nfo.offset = reader.getOffset();
+				reader.skipString();
+				pos = reader.getOffset();
 			}
 			break;
 		case LEAF::LF_UNION:
 			{
 				reader.seek(reader.getOffset() + sizeof(LeafUnion) + sizeof(uint16_t));
-				nfo.name = reader.readString();
+				nfo.offset = reader.getOffset();
+				reader.skipString();
+				pos = reader.getOffset();
 			}
 			break;
 		case LEAF::LF_ENUM:
 			{
 				reader.seek(reader.getOffset() + sizeof(LeafEnum));
-				nfo.name = reader.readString();
+				nfo.offset = reader.getOffset();
+				reader.skipString();
+				pos = reader.getOffset();
 			}
 			break;
 		case LEAF::LF_ALIAS:
 			{
 				reader.seek(reader.getOffset() + sizeof(LeafAlias));
-				nfo.name = reader.readString();
+				nfo.offset = reader.getOffset();
+				reader.skipString();
+				pos = reader.getOffset();
 			}
 			break;
 		case LEAF::LF_INDEX:
-			nfo.data = reader.read<uint8_t>(sizeof(LeafIndex));
+			size = sizeof(LeafIndex);
 			break;
 		default:
 			{
 				if (nfo.type < LEAF::LF_NUMERIC || nfo.type > LEAF::LF_UTF8STRING)
 					continue;
 
-				nfo.data = reader.read<uint8_t>(end - reader.getOffset());
-			}
-			break;
-		}
+				size = end - pos;
+			}
+			break;
+		}
+
+		if (!reader.isValidRange(pos, size))
+			throw std::runtime_error("Reading past the end of the stream");
+		pos += size;
+
+		nfo.size = std::max(end, pos) - nfo.offset;
+		table.at(i) = nfo;
+	}
+
+	table.addDecoded(last - first);
+	return last;
+}
+
+std::vector<PDBParser::TypeChunk>
+PDBParser::getTypeOffsets(const TypeInfoHeader& header, uint32_t start)
+{
+	std::vector<TypeChunk> offsets;
+
+	// The offsets are relative to the end of the header
+	if (header.sn == 0xffff || header.sn >= m_streams.size() || header.headerSize != (int32_t)start
+		|| header.tiOff.off < 0 || header.tiOff.cb < (int32_t)(2 * sizeof(TypeChunk)))
+		return offsets;
+
+	if ((uint64_t)header.tiOff.off + header.tiOff.cb > getStream(header.sn).size)
+		return offsets;
+
+	// Every entry is a type index and the offset of its record. Only they are
+	// read, not the hashes of every type before them.
+	size_t numEntries = header.tiOff.cb / sizeof(TypeChunk);
+	StreamReader reader = openStream(header.sn);
+	reader.seek(header.tiOff.off);
+	auto table = reader.read<TypeChunk>((uint32_t)(numEntries * sizeof(TypeChunk)));
+	const TypeChunk* entries = table.data;
+	uint32_t streamSize = getStream(TypeInfoStream).size;
+
+	for (size_t i = 0; i < numEntries; ++i)
+	{
+		TypeChunk entry = { entries[i].first, entries[i].offset + start };
+		if (entry.first < header.min || entry.first >= header.max || entry.offset >= streamSize || entry.offset < start)
+			return std::vector<TypeChunk>();
+
+		// Both have to go up, or the table can't be trusted
+		if (!offsets.empty() && (entry.first <= offsets.back().first || entry.offset <= offsets.back().offset))
+			return std::vector<TypeChunk>();
+
+		offsets.push_back(entry);
+	}
+
+	// The first chunk has to start with the first type
+	if (offsets[0].first != header.min)
+		return std::vector<TypeChunk>();
+
+	return offsets;
+}
+
+std::vector<PDBParser::TypeChunk>
+PDBParser::getTypeChunks(const TypeInfoHeader& header, uint32_t start, size_t count)
+{
+	std::vector<TypeChunk> chunks;
+
+	auto offsets = getTypeOffsets(header, start);
+	if (offsets.empty())
+		return chunks;
+
+	// Pick the entries that split the stream most evenly
+	uint32_t streamSize = getStream(TypeInfoStream).size;
+	uint64_t total = streamSize - start;
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint64_t target = start + total * i / count;
+		auto it = std::lower_bound(offsets.begin(), offsets.end(), target,
+			[](const TypeChunk& entry, uint64_t offset) { return entry.offset < offset; });
+		if (it == offsets.end())
+			break;
+
+		if (chunks.empty() || it->offset > chunks.back().offset)
+			chunks.push_back(*it);
+	}
+
+	return chunks;
+}
+
+DataPtr<uint8_t>
+PDBParser::TypeTable::record(const TypeInfo& info) const
+{
+	if (!m_stream)
+		return DataPtr<uint8_t>(m_view.data() + info.offset);
+
+	StreamReader reader(*m_stream, *m_parser, info.offset);
+	return reader.read<uint8_t>(info.size);
+}
+
+StreamReader
+PDBParser::TypeTable::reader() const
+{
+	if (!m_stream)
+		return StreamReader(m_view);
+
+	return StreamReader(*m_stream, *m_parser);
+}
+
+void
+PDBParser::TypeTable::resolve(uint32_t type) const
+{
+	// The first block starts with the first type, so there's always one
+	auto it = std::upper_bound(m_blocks.begin(), m_blocks.end(), type,
+		[](uint32_t t, const TypeChunk& block) { return t < block.first; });
+	size_t block = (it - m_blocks.begin()) - 1;
+
+	std::call_once(m_once[block], m_decode, block);
+}
+
+void
+PDBParser::decodeTypeBlock(TypeTable& table, size_t block, uint32_t start)
+{
+	auto& blocks = table.blocks();
+	uint32_t first = blocks[block].first;
+	uint32_t last = block + 1 < blocks.size() ? blocks[block + 1].first : table.max();
+
+	uint32_t end = blocks[block].offset;
+	bool lined;
+	try
+	{
+		StreamReader reader = table.reader();
+		uint32_t stop = readTypes(reader, first, last, end, table);
+
+		// Records are aligned, so the next block starts at the next multiple
+		// of 4, and the last one runs to the end of the stream. A record
+		// without a type is as likely to be the block starting in the wrong
+		// place, so that's left to the fallback too.
+		if (stop != last)
+			lined = false;
+		else if (block + 1 < blocks.size())
+			lined = ((end + 3) & ~3u) == blocks[block + 1].offset;
+		else
+			lined = ((end + 3) & ~3u) >= table.size();
+	}
+	catch (BudgetExceeded&)
+	{
+		table.clear(first, last);
+		throw;
+	}
+	catch (std::exception&)
+	{
+		lined = false;
+	}
+
+	if (!lined)
+		table.copy(typeFallback(table, start), first, last);
+}
+
+const PDBParser::TypeTable&
+PDBParser::typeFallback(const TypeTable& table, uint32_t start)
+{
+	std::lock_guard<std::mutex> lock(m_typeFallbackLock);
+
+	if (!m_typeFallback)
+	{
+		std::unique_ptr<TypeTable> fallback(new TypeTable);
+		fallback->resetLike(table);
 
-		map.insert(std::make_pair(i, std::move(nfo)));
+		StreamReader reader = table.reader();
+		uint32_t end = start;
+		readTypes(reader, table.min(), table.max(), end, *fallback);
+		m_typeFallback = std::move(fallback);
 	}
 
-	return map;
+	return *m_typeFallback;
 }
 
 void
 PDBParser::close()
 {
-  m_mapping.Unmap();
+	if (m_prefetcher)
+		m_prefetcher->Stop();
+	m_streamCopies.clear();
+	m_mapping.Unmap();
+	m_pageCache.Close();
+	m_windows.Close();
+	m_pipe.Close();
+	m_base = nullptr;
+	// The parser can load another PDB after this, the arenas keep their
+	// memory for it
+	m_streams.clear();
+	m_nameIndices.clear();
+	m_foundPE = false;
+	m_typeFallback.reset();
+	m_arena.reset();
+	m_scratchArena.reset();
+	for (auto& a : m_taskArenas)
+		a->reset();
+	m_strings.reset();
 }
 
 struct SymbolSource
@@ -823,11 +2140,27 @@ struct SymbolSource
 void
 PDBParser::printBreakpadSymbols(FILE* of, const char* platform, FileMod* fileMod)
 {
-	const StreamPair& pair = getStream(DebugInfo);
-	if (pair.size == 0)
+	if (getStream(DebugInfo).size == 0)
 		throw std::runtime_error("Invalid DebugInfo stream");
 
-	StreamReader reader(pair, *this);
+	// Nothing from a previous call can still be around
+	m_typeFallback.reset();
+	m_typeStats = TypeStats();
+	m_arena.reset();
+	m_scratchArena.reset();
+	for (auto& a : m_taskArenas)
+		a->reset();
+	m_strings.reset();
+
+	m_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(m_budget.seconds));
+	m_bytesAllocated = 0;
+	m_budgetReason = nullptr;
+	m_arena.setCounter(&m_bytesAllocated);
+	m_scratchArena.setCounter(&m_bytesAllocated);
+	m_strings.setCounter(&m_bytesAllocated);
+
+	StreamReader reader = openStream(DebugInfo, arena(m_arena));
 	auto header = reader.read<DBIHeader>();
 
 	printHeader(header.data, of, platform);
@@ -897,25 +2230,160 @@ PDBParser::printBreakpadSymbols(FILE* of, const char* platform, FileMod* fileMod
 	if (debugHeader->sectionHdr != 0xFFFF)
 	{
 		readSectionHeaders(debugHeader->sectionHdr, sections);
+		m_scratchArena.reset();
 	}
 
-	uint32_t id = 1;
-	UniqueSrcFiles unique;
-	for (auto& mod : modules)
+	// The TPI's hash stream has the offsets that the types are split up by
+	int32_t typeHash = -1;
+	if (getStream(TypeInfoStream).size >= sizeof(TypeInfoHeader))
+		typeHash = openStream(TypeInfoStream).peek<TypeInfoHeader>().sn;
+
+	// The streams that are read alongside the modules, an unused one is 0xffff
+	int32_t shared[] = { TypeInfoStream, header->symRecordStream, debugHeader->sectionHdr, debugHeader->FPO, debugHeader->newFPO, -1, typeHash };
+	for (auto& index : shared)
+	{
+		if (index == 0xffff)
+			index = -1;
+	}
+
+	auto nIter = m_nameIndices.find("/NAMES");
+	if (nIter != m_nameIndices.end())
+		shared[5] = nIter->second;
+
+	// Everything that's still to be read is known now, so a pipe can stop
+	// holding on to the pages of every other stream
+	if (m_pipe.Valid())
+	{
+		std::vector<int32_t> needed(std::begin(shared), std::end(shared));
+		needed.push_back(DebugInfo);
+		for (auto& mod : modules)
+			needed.push_back(mod.info.data->stream);
+
+		retainStreams(needed);
+	}
+
+	// The shared streams make up the first step of the plan, then every module
+	// stream is a step of its own.
+	bool advise = m_useAccessPlan && m_mapping.Valid();
+	// The prefetcher reads the file itself, which is no use if it had to be decompressed
+	bool prefetch = m_prefetchDepth && !m_path.empty() && !m_mapping.IsDecompressed();
+	m_prefetcher.reset();
+	if (advise || prefetch)
 	{
-		if (mod.info.data->stream < 0)
+		MMapWrapper::AccessPlan plan(1);
+
+		for (auto index : shared)
 		{
-			fprintf(stderr, "Invalid module found gathering files...\n");
-			continue;
+			auto ranges = getStreamRanges(index);
+			plan[0].insert(plan[0].end(), ranges.begin(), ranges.end());
+		}
+
+		for (auto& mod : modules)
+			plan.push_back(getStreamRanges(mod.info.data->stream));
+
+		if (prefetch)
+		{
+			m_prefetcher.reset(new Prefetcher);
+			if (!m_prefetcher->Start(m_path.c_str(), plan, m_prefetchDepth))
+			{
+				fprintf(stderr, "Failed to start prefetching, reading on demand instead\n");
+				m_prefetcher.reset();
+			}
 		}
 
-		getModuleFiles(mod.info.data, id, unique, mod.srcIndex);
+		if (advise)
+			m_mapping.SetAccessPlan(std::move(plan), 8);
+
+		beginStep(0);
 	}
 
 	NameStream names;
+	TypeTable tm;
+	UniqueSrcFiles unique;
+	std::vector<ModuleDecoder> decoded(modules.size());
 
-	// Start printing the module files in a separate thread
+	// The types and the module files are loaded and printed on other threads.
+	// Anything the tasks use has to be declared before the group, which waits
+	// for them when an exception unwinds past it.
 	Concurrency::task_group tg;
+	tg.run([this, &tm] { loadTypeStream(tm); });
+
+	// Every module stream is read just once, and each can be decoded on its
+	// own. The arenas are only created on this thread, tasks just use them.
+	size_t tasks = std::min<size_t>(Concurrency::GetProcessorCount(), modules.size());
+	if (m_decodeTasks)
+		tasks = std::min(tasks, m_decodeTasks);
+	for (size_t t = 0; t < tasks; ++t)
+		taskArena(t);
+
+	// The first module that went over the budget, which a module after it may
+	// have finished decoding before on another task
+	std::atomic<size_t> breached(modules.size());
+
+	auto decodeModule = [this, &modules, &decoded, &breached](size_t i, Arena* a) {
+		auto module = modules[i].info.data;
+
+		beginStep(i + 1);
+		try
+		{
+			checkBudget();
+			if (module->stream < 0)
+				fprintf(stderr, "Invalid module found gathering files...\n");
+			else
+				decoded[i].decode(*this, module, a);
+		}
+		catch (BudgetExceeded&)
+		{
+			if (!truncating())
+				throw;
+
+			// Whatever of the module was read is left out, along with every
+			// module after it once they're all done
+			size_t first = breached;
+			while (i < first && !breached.compare_exchange_weak(first, i))
+				;
+			return;
+		}
+	};
+
+	if (tasks <= 1)
+	{
+		for (size_t i = 0; i < modules.size(); ++i)
+			decodeModule(i, taskArena(0));
+	}
+	else
+	{
+		// Modules are handed out in order, so that the steps of the access plan
+		// are still reached in roughly the order they were planned in
+		std::atomic<size_t> next(0);
+
+		Concurrency::task_group mtg;
+		for (size_t t = 0; t < tasks; ++t)
+		{
+			Arena* a = taskArena(t);
+			mtg.run([&modules, &next, &decodeModule, a]() {
+				for (size_t i = next++; i < modules.size(); i = next++)
+					decodeModule(i, a);
+			});
+		}
+		mtg.wait();
+	}
+
+	// Modules after the first that went over are left out, however they were
+	// spread over the tasks
+	for (size_t i = breached; i < modules.size(); ++i)
+		decoded[i] = ModuleDecoder();
+
+	// Everything has been read, the prefetcher's numbers stay around for reporting
+	if (m_prefetcher)
+		m_prefetcher->Stop();
+
+	// File ids are handed out in module order
+	uint32_t id = 1;
+	for (size_t i = 0; i < modules.size(); ++i)
+		addModuleFiles(decoded[i], id, unique, modules[i].srcIndex);
+
+	// Start printing the module files in a separate thread
 	tg.run(
 	       [this, &unique, &modules, &names, of, fileMod]() {
 			loadNameStream(names);
@@ -950,9 +2418,6 @@ PDBParser::printBreakpadSymbols(FILE* of, const char* platform, FileMod* fileMod
 			}
 		});
 
-	TypeMap tm;
-	tg.run([this, &tm] { tm = loadTypeStream(); });
-
 	// Check to see if we need to remap functions
 	if (debugHeader->tokenRidMap != 0 && debugHeader->tokenRidMap != 0xffff)
 		throw std::runtime_error("Implement me...");
@@ -961,17 +2426,45 @@ PDBParser::printBreakpadSymbols(FILE* of, const char* platform, FileMod* fileMod
 	Globals globals;
 	getGlobalFunctions(header->symRecordStream, sections, globals);
 
-	Functions functions;
-	for (auto& mod : modules)
+	// The functions of every module are joined up in module order, the order
+	// they would be in had the modules been decoded one after another
+	size_t total = 0;
+	for (auto& mod : decoded)
+		total += mod.functions.size();
+
+	FunctionTable functions;
+	functions.reserve(total);
+	for (auto& mod : decoded)
 	{
-		getModuleFunctions(mod.info.data, functions);
+		functions.add(mod.functions);
+		mod.functions.clear();
 	}
 
-	Concurrency::parallel_sort(functions.begin(), functions.end());
+	functions.sort();
 
-	for (auto& mod : modules)
+	if (tasks <= 1)
+	{
+		for (size_t i = 0; i < modules.size(); ++i)
+			resolveFunctionLines(decoded[i], functions, 0, functions.size(), unique, modules[i].srcIndex, taskArena(0));
+	}
+	else
 	{
-		resolveFunctionLines(mod.info.data, functions, unique, mod.srcIndex);
+		// The first module to have lines for a function wins. Every task goes
+		// through all of the modules in order, but only resolves the lines of
+		// its own range of functions, so each function is still won by the
+		// same module.
+		Concurrency::task_group ltg;
+		for (size_t t = 0; t < tasks; ++t)
+		{
+			size_t first = functions.size() * t / tasks;
+			size_t last = functions.size() * (t + 1) / tasks;
+			Arena* a = taskArena(t);
+			ltg.run([this, &modules, &decoded, &functions, &unique, first, last, a]() {
+				for (size_t i = 0; i < modules.size(); ++i)
+					resolveFunctionLines(decoded[i], functions, first, last, unique, modules[i].srcIndex, a);
+			});
+		}
+		ltg.wait();
 	}
 
 	std::map<std::pair<uint32_t, uint32_t>, DataPtr<FPO_DATA>> fpov1Data;
@@ -985,38 +2478,38 @@ PDBParser::printBreakpadSymbols(FILE* of, const char* platform, FileMod* fileMod
 		readFPO(debugHeader->newFPO, fpov2Data);
 	}
 
-	// We cheat in the Function < operator so that we can sort
-	// first, now iterate over the functions and remove the functions that are duplicates,
-	// we don't actually remove the functions, just make it so that they are skipped from printing
-	FunctionRecord* current = &functions[0];
-	for (uint32_t i = 1, end = (uint32_t)functions.size(); i < end; ++i)
+	// Functions at the same address are next to each other now, so iterate over
+	// the keys and remove the functions that are duplicates, we don't actually
+	// remove the functions, just make it so that they are skipped from printing
+	size_t current = 0;
+	for (size_t i = 1, end = functions.size(); i < end; ++i)
 	{
-		if (*current == functions[i])
+		if (functions.keys[current] == functions.keys[i])
 		{
 			// Duplicate! Preserve whichever one is 'most' interesting
-			if (current->lines.data || !functions[i].lines.data)
-				functions[i].segment = 0xffffffff;
-			else if (functions[i].lines.data)
+			if (functions.lines[current].data || !functions.lines[i].data)
+				functions.skip(i);
+			else
 			{
-				current->segment = 0xffffffff;
-				current = &functions[i];
+				functions.skip(current);
+				current = i;
 			}
 		}
 		else
-			current = &functions[i];
+			current = i;
 	}
 	// Offset functions by segment address and
 	// try to fill in paramSize from FPO data.
-	for (auto& func : functions)
+	for (size_t f = 0, end = functions.size(); f < end; ++f)
 	{
-		if (func.segment == 0xffffffff)
+		if (functions.skipped(f))
 			continue;
-		func.offset += sections[func.segment - 1].VirtualAddress;
-		if (!updateParamSize(func, fpov2Data))
+		functions.setOffset(f, functions.offset(f) + sections[functions.segment(f) - 1].VirtualAddress);
+		if (!updateParamSize(functions, f, fpov2Data))
 		{
-			if (!updateParamSize(func, fpov1Data))
+			if (!updateParamSize(functions, f, fpov1Data))
 			{
-				updateParamSize(func, globals);
+				updateParamSize(functions, f, globals);
 			}
 		}
 	}
@@ -1024,26 +2517,70 @@ PDBParser::printBreakpadSymbols(FILE* of, const char* platform, FileMod* fileMod
 	// Wait for the type stream to be loaded, and all of the src files to be written
 	tg.wait();
 
-	printFunctions(functions, tm, of);
+	// Everything from here on is formatted into chunks that a writer thread
+	// writes while the next ones are being formatted. Only a few chunks are
+	// held at once, so the formatted text never has to be held all at once.
+	ChunkWriter writer(of, std::max<size_t>(8, Concurrency::GetProcessorCount() * 2));
+
+	// Names nested too deep have to be found every time to be caught
+	TypeNameCache typeNames;
+	printFunctions(functions, tm, m_budget.maxTypeDepth ? nullptr : &typeNames, writer);
+
+	printFPOs(fpov2Data, names, writer);
+	printFPOs(fpov1Data, names, writer);
+
+	writer.Finish();
+
+	m_typeStats.types = tm.max() - tm.min();
+	m_typeStats.decoded = tm.decoded();
+	m_typeStats.nameHits = typeNames.hits();
+	m_typeStats.nameMisses = typeNames.misses();
+
+	// Symbols that didn't all make it out mustn't pass for a whole dump
+	int error = writer.Error();
+	if (!error && (fflush(of) != 0 || ferror(of)))
+		error = errno ? errno : EIO;
+	if (error)
+		throw std::runtime_error(std::string("Failed to write the symbols: ") + strerror(error));
+
+	if (const char* reason = m_budgetReason)
+		fprintf(stderr, "Warning: %s, the symbols are incomplete\n", reason);
+}
 
-	printFPOs(fpov2Data, names, of);
-	printFPOs(fpov1Data, names, of);
+void
+PDBParser::checkBudget()
+{
+	if (m_budgetReason)
+		throw BudgetExceeded(m_budgetReason.load());
 
-	fflush(of);
+	if (m_budget.seconds > 0 && std::chrono::steady_clock::now() > m_deadline)
+		exceedBudget("Ran out of time");
+	if (m_budget.maxBytes && m_bytesAllocated.load(std::memory_order_relaxed) > m_budget.maxBytes)
+		exceedBudget("Ran out of memory");
 }
 
 void
-PDBParser::readModule(const DBIModuleInfo* module, int32_t section, ModuleReadCB cb)
+PDBParser::exceedBudget(const char* reason)
 {
-	const StreamPair& pair = getStream(module->stream);
+	// Only the first reason is kept, whatever the other threads run into after
+	const char* none = nullptr;
+	m_budgetReason.compare_exchange_strong(none, reason);
+	throw BudgetExceeded(m_budgetReason.load());
+}
 
-	StreamReader reader(pair, *this);
+void
+PDBParser::ModuleDecoder::decode(PDBParser& parser, const DBIModuleInfo* module, Arena* arena)
+{
+	stream = module->stream;
+	StreamReader reader = parser.openStream(module->stream, arena);
 	auto sig = reader.read<int32_t>();
 
 	if (*sig.data != 4)
 		throw std::runtime_error("Invalid module stream signature");
 
-	// Skip functions
+	readSymbols(parser, reader, (uint32_t)module->cbSyms);
+
+	// Skip the old style lines
 	reader.seek(module->cbSyms + module->cbOldLines);
 	uint32_t endOffset = reader.getOffset() + module->cbLines;
 
@@ -1065,8 +2602,40 @@ PDBParser::readModule(const DBIModuleInfo* module, int32_t section, ModuleReadCB
 		if (!reader.isValidOffset(end))
 			throw std::runtime_error("Invalid subsection header detected");
 
-		if (header->sig == section)
-			cb(reader, header->sig, end);
+		if (header->sig == Subsection::FileChecksums)
+		{
+			uint32_t index = reader.getOffset();
+
+			while (reader.getOffset() < end)
+			{
+				FileChecksum file;
+				file.offset = reader.getOffset() - index;
+
+				auto fileChk = reader.read<CVFileChecksum>();
+				file.name = fileChk->name;
+				files.push_back(file);
+
+				// Skip past the actual checksum itself
+				reader.seek(reader.getOffset() + fileChk->len);
+				reader.align(4);
+			}
+		}
+		else if (header->sig == Subsection::Lines)
+		{
+			auto ls = reader.read<CV_LineSection>();
+			auto srcfile = reader.read<CV_SourceFile>();
+
+			LineBlock block(ls->sec, ls->off);
+			block.file = srcfile->index;
+			block.count = srcfile->count;
+
+			// The lines are read once it's known which blocks win
+			block.linesAt = reader.getOffset();
+			if (block.linesAt > end || (uint64_t)block.count * sizeof(CV_Line) > end - block.linesAt)
+				throw std::runtime_error("Invalid line block detected");
+
+			lines.push_back(std::move(block));
+		}
 
 		reader.seek(end);
 
@@ -1076,6 +2645,34 @@ PDBParser::readModule(const DBIModuleInfo* module, int32_t section, ModuleReadCB
 	}
 }
 
+std::string
+PDBParser::debugIdentifier(uint32_t age) const
+{
+	char id[64];
+	snprintf(id, sizeof(id), "%08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%x",
+		m_guid.Data1, m_guid.Data2, m_guid.Data3,
+		m_guid.Data4[0], m_guid.Data4[1], m_guid.Data4[2], m_guid.Data4[3],
+		m_guid.Data4[4], m_guid.Data4[5], m_guid.Data4[6], m_guid.Data4[7],
+		age);
+	return id;
+}
+
+std::string
+PDBParser::debugIdentifier()
+{
+	if (getStream(DebugInfo).size < sizeof(DBIHeader))
+		throw std::runtime_error("Invalid DebugInfo stream");
+
+	return debugIdentifier(openStream(DebugInfo).peek<DBIHeader>().age);
+}
+
+std::string
+PDBParser::symbolStorePath()
+{
+	// m_filename keeps the dot before the extension
+	return m_filename + "pdb/" + debugIdentifier() + "/" + m_filename + "sym";
+}
+
 void
 PDBParser::printHeader(const DBIHeader* header, FILE* of, const char* platform)
 {
@@ -1101,18 +2698,10 @@ PDBParser::printHeader(const DBIHeader* header, FILE* of, const char* platform)
 			break;
 		}
 
-		fprintf(of, "MODULE windows %s %08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%x %spdb\n", machineType,
-			m_guid.Data1, m_guid.Data2, m_guid.Data3,
-			m_guid.Data4[0], m_guid.Data4[1], m_guid.Data4[2], m_guid.Data4[3],
-			m_guid.Data4[4], m_guid.Data4[5], m_guid.Data4[6], m_guid.Data4[7],
-			header->age, m_filename.c_str());
+		fprintf(of, "MODULE windows %s %s %spdb\n", machineType, debugIdentifier(header->age).c_str(), m_filename.c_str());
 	}
 	else
-		fprintf(of, "MODULE %s %08X%04X%04X%02X%02X%02X%02X%02X%02X%02X%02X%x %spdb\n", platform,
-			m_guid.Data1, m_guid.Data2, m_guid.Data3,
-			m_guid.Data4[0], m_guid.Data4[1], m_guid.Data4[2], m_guid.Data4[3],
-			m_guid.Data4[4], m_guid.Data4[5], m_guid.Data4[6], m_guid.Data4[7],
-			header->age, m_filename.c_str());
+		fprintf(of, "MODULE %s %s %spdb\n", platform, debugIdentifier(header->age).c_str(), m_filename.c_str());
 
 	if (m_foundPE)
 		fprintf(of, "INFO CODE_ID %08X%X %s%s\n", m_PETimeStamp, m_PESize, m_filename.c_str(), m_isExe ? "exe" : "dll");
@@ -1123,7 +2712,7 @@ PDBParser::readSectionHeaders(uint32_t headerStream, SectionHeaders& headers)
 {
 	auto& hs = getStream(headerStream);
 
-	StreamReader reader(hs, *this);
+	StreamReader reader(hs, *this, 0, arena(m_scratchArena));
 
 	while (reader.getOffset() < hs.size)
 	{
@@ -1133,57 +2722,37 @@ PDBParser::readSectionHeaders(uint32_t headerStream, SectionHeaders& headers)
 }
 
 void
-PDBParser::getModuleFiles(const DBIModuleInfo* module, uint32_t& id, UniqueSrcFiles& unique, SrcFileIndex& fileIndices)
+PDBParser::addModuleFiles(const ModuleDecoder& module, uint32_t& id, UniqueSrcFiles& unique, SrcFileIndex& fileIndices)
 {
-	readModule(module, Subsection::FileChecksums,
-		[module, &id, &unique, &fileIndices](StreamReader& reader, int32_t sig, uint32_t end)
+	for (auto& file : module.files)
+	{
+		auto fiter = unique.find(file.name);
+		if (fiter == unique.end())
 		{
-			uint32_t index = reader.getOffset();
-
-			while (reader.getOffset() < end)
-			{
-				uint32_t msid = reader.getOffset() - index;
-				auto fileChk = reader.read<CVFileChecksum>();
-
-				auto fiter = unique.find(fileChk->name);
-				if (fiter == unique.end())
-				{
-					auto& fileid = unique[fileChk->name];
-					fileid.id = id++;
-				}
-				else
-					id++;
-
-				fileIndices.insert(std::make_pair(msid, fileChk->name));
+			auto& fileid = unique[file.name];
+			fileid.id = id++;
+		}
+		else
+			id++;
 
-				// Skip past the actual checksum itself
-				reader.seek(reader.getOffset() + fileChk->len);
-				reader.align(4);
-			}
-		});
+		fileIndices.insert(std::make_pair(file.offset, file.name));
+	}
 }
 
 void
-PDBParser::getModuleFunctions(const DBIModuleInfo* module, Functions& funcs)
+PDBParser::ModuleDecoder::readSymbols(PDBParser& parser, StreamReader& reader, uint32_t end)
 {
-	const StreamPair& pair = getStream(module->stream);
-
-	StreamReader reader(pair, *this);
-	auto sig = reader.read<int32_t>();
-
-	if (*sig.data != 4)
-		throw std::runtime_error("Invalid module stream signature");
-
 	struct SymbolHeader
 	{
 		uint16_t size;
 		uint16_t type;
 	};
 
-	uint32_t end = (uint32_t)module->cbSyms;
-
-	while (reader.getOffset() < end)
+	for (uint32_t records = 0; reader.getOffset() < end; ++records)
 	{
+		if ((records & 255) == 0)
+			parser.checkBudget();
+
 		auto header = reader.read<SymbolHeader>();
 
 		uint32_t offsetBeg = reader.getOffset() - sizeof(uint16_t);
@@ -1196,13 +2765,8 @@ PDBParser::getModuleFunctions(const DBIModuleInfo* module, Functions& funcs)
 				auto proc = reader.read<ProcSym32>();
 				auto name = reader.readString();
 
-				FunctionRecord rec(std::move(name));
-				rec.offset = proc->off;
-				rec.segment = proc->seg;
-				rec.length = proc->len;
-				rec.typeIndex = proc->typind;
-
-				funcs.push_back(std::move(rec));
+				FunctionRecord rec = { parser.intern(name), proc->seg, proc->off, proc->len, proc->typind };
+				functions.push_back(rec);
 			}
 			break;
 		case SymbolDefs::S_THUNK32:
@@ -1210,12 +2774,8 @@ PDBParser::getModuleFunctions(const DBIModuleInfo* module, Functions& funcs)
 				auto thunk = reader.read<ThunkSym32>();
 				auto name = reader.readString();
 
-				FunctionRecord rec(std::move(name));
-				rec.offset = thunk->off;
-				rec.segment = thunk->seg;
-				rec.length = thunk->parent != 0 ? thunk->len : 0;
-
-				funcs.push_back(std::move(rec));
+				FunctionRecord rec = { parser.intern(name), thunk->seg, thunk->off, thunk->parent != 0 ? thunk->len : 0u, 0 };
+				functions.push_back(rec);
 			}
 			break;
 		default:
@@ -1230,10 +2790,10 @@ PDBParser::getModuleFunctions(const DBIModuleInfo* module, Functions& funcs)
 void
 PDBParser::getGlobalFunctions(uint16_t symRecStream, const SectionHeaders& headers, Globals& globals)
 {
-	const StreamPair& pair = getStream(symRecStream);
-	StreamReader reader(pair, *this);
+	uint32_t size = getStream(symRecStream).size;
+	StreamReader reader = openStream(symRecStream, arena(m_arena));
 
-	while (reader.getOffset() < pair.size)
+	while (reader.getOffset() < size)
 	{
 		auto len = *reader.read<uint16_t>().data;
 		if (len >= sizeof(GlobalRecord))
@@ -1244,7 +2804,8 @@ PDBParser::getGlobalFunctions(uint16_t symRecStream, const SectionHeaders& heade
 			// Is function?
 			if (rec->symType == 2)
 			{
-				globals.insert(std::make_pair(rec->offset + headers[rec->segment - 1].VirtualAddress, std::move(name)));
+				globals.insert(std::make_pair(rec->offset + headers[rec->segment - 1].VirtualAddress,
+					intern(name, len - sizeof(GlobalRecord)).data));
 			}
 		}
 		else
@@ -1256,71 +2817,277 @@ PDBParser::getGlobalFunctions(uint16_t symRecStream, const SectionHeaders& heade
 }
 
 void
-PDBParser::resolveFunctionLines(const DBIModuleInfo* module, Functions& funcs, const UniqueSrcFiles& unique, const SrcFileIndex& fileIndex)
+PDBParser::FunctionTable::reserve(size_t count)
+{
+	keys.reserve(count);
+	names.reserve(count);
+	lengths.reserve(count);
+	typeIndices.reserve(count);
+	lines.reserve(count);
+	lineCounts.reserve(count);
+	lineOffsets.reserve(count);
+	fileIndices.reserve(count);
+	paramSizes.reserve(count);
+}
+
+void
+PDBParser::FunctionTable::add(const std::vector<FunctionRecord>& functions)
+{
+	for (auto& func : functions)
+	{
+		keys.push_back(((uint64_t)func.segment << 32) | func.offset);
+		names.push_back(func.name);
+		lengths.push_back(func.length);
+		typeIndices.push_back(func.typeIndex);
+	}
+
+	// Nothing else is known until the lines are resolved
+	lines.resize(keys.size());
+	lineCounts.resize(keys.size());
+	lineOffsets.resize(keys.size());
+	fileIndices.resize(keys.size());
+	paramSizes.resize(keys.size());
+}
+
+void
+PDBParser::FunctionTable::sort()
 {
-	readModule(module, Subsection::Lines,
-		[&funcs, &unique, &fileIndex](StreamReader& reader, int32_t sig, uint32_t end)
+	size_t count = size();
+	if (count < 2)
+		return;
+
+	std::vector<uint64_t> sorted(keys);
+	std::vector<uint64_t> sortedScratch(count);
+	std::vector<uint32_t> order(count);
+	std::vector<uint32_t> orderScratch(count);
+	for (size_t i = 0; i < count; ++i)
+		order[i] = (uint32_t)i;
+
+	// A byte at a time from the lowest, carrying the indices along. Bytes
+	// that are the same in every key, like most of the segment's, are skipped.
+	uint64_t differ = 0;
+	for (auto key : keys)
+		differ |= key ^ keys[0];
+
+	for (unsigned shift = 0; shift < 64; shift += 8)
+	{
+		if (((differ >> shift) & 0xff) == 0)
+			continue;
+
+		size_t starts[256] = {};
+		for (auto key : sorted)
+			++starts[(key >> shift) & 0xff];
+
+		size_t total = 0;
+		for (auto& start : starts)
 		{
-			auto ls = reader.read<CV_LineSection>();
+			size_t n = start;
+			start = total;
+			total += n;
+		}
 
-			size_t min = 0;
-			size_t max = funcs.size() - 1;
-			while (min < max)
-			{
-				size_t mid = (min + max) >> 1;
+		for (size_t i = 0; i < count; ++i)
+		{
+			size_t to = starts[(sorted[i] >> shift) & 0xff]++;
+			sortedScratch[to] = sorted[i];
+			orderScratch[to] = order[i];
+		}
 
-				auto& func = funcs[mid];
-				if (func.segment < ls->sec || (func.segment == ls->sec && func.offset < ls->off))
-					min = mid + 1;
-				else
-					max = mid;
-			}
+		sorted.swap(sortedScratch);
+		order.swap(orderScratch);
+	}
 
-			auto& function = funcs[min];
-			if (function.lineOffset != 0 && (function.lineOffset - function.offset < ls->off - function.offset
-				|| function.lineCount & 0xF0000000)) // This means the first function always wins, which seems to be the behavior of the original Breakpad implementation
-				return;
+	// This is merely to make which duplicate wins not depend on the order
+	// the modules were in. At this point we have no way to differentiate
+	// between two functions at the same address, so anything that tells
+	// them apart is compared.
+	for (size_t first = 0; first < count;)
+	{
+		size_t last = first + 1;
+		while (last < count && sorted[last] == sorted[first])
+			++last;
 
-			auto srcfile = reader.read<CV_SourceFile>();
+		if (last - first > 1)
+		{
+			std::sort(order.begin() + first, order.begin() + last, [this](uint32_t a, uint32_t b) {
+				if (typeIndices[a] != typeIndices[b])
+					return typeIndices[a] < typeIndices[b];
+				if (lengths[a] != lengths[b])
+					return lengths[a] < lengths[b];
+				return names[a].id != names[b].id && strcmp(names[a].data, names[b].data) < 0;
+			});
+		}
 
-			// First find the module specific file offset
-			uint32_t fileChk = fileIndex.at(srcfile->index);
+		first = last;
+	}
+
+	permute(order);
+}
+
+namespace
+{
+template<typename T>
+void permuteColumn(std::vector<T>& column, const std::vector<uint32_t>& order)
+{
+	std::vector<T> permuted;
+	permuted.reserve(column.size());
+	for (auto i : order)
+		permuted.push_back(std::move(column[i]));
+	column.swap(permuted);
+}
+}
 
-			// Next get the unique id that is paired with that particular file
-			function.fileIndex = unique.at(fileChk).id;
+void
+PDBParser::FunctionTable::permute(const std::vector<uint32_t>& order)
+{
+	permuteColumn(keys, order);
+	permuteColumn(names, order);
+	permuteColumn(lengths, order);
+	permuteColumn(typeIndices, order);
+	permuteColumn(lines, order);
+	permuteColumn(lineCounts, order);
+	permuteColumn(lineOffsets, order);
+	permuteColumn(fileIndices, order);
+	permuteColumn(paramSizes, order);
+}
 
-			function.lineCount = srcfile->count;
-			function.lineOffset = ls->off;
+void
+PDBParser::resolveFunctionLines(ModuleDecoder& module, FunctionTable& funcs, size_t first, size_t last,
+	const UniqueSrcFiles& unique, const SrcFileIndex& fileIndex, Arena* arena)
+{
+	if (funcs.size() == 0 || module.lines.empty())
+		return;
 
-			if (function.lineCount)
-				function.lines = reader.read<uint8_t>(srcfile->count * sizeof(CV_Line));
+	// Only the lines of the blocks that win are read, which are all that a
+	// copying backend has to keep
+	StreamReader reader = openStream(module.stream, arena);
 
-			// Mark that the function has been encountered
-			function.lineCount |= 0xF0000000;
-		});
+	for (auto& block : module.lines)
+	{
+		// The first function at or after the block, or the last one if there
+		// isn't one
+		uint64_t key = ((uint64_t)block.segment << 32) | block.offset;
+		size_t f = std::lower_bound(funcs.keys.begin(), funcs.keys.end() - 1, key) - funcs.keys.begin();
+
+		if (f < first || f >= last)
+			continue;
+
+		uint32_t offset = funcs.offset(f);
+		if (funcs.lineOffsets[f] != 0 && (funcs.lineOffsets[f] - offset < block.offset - offset
+			|| funcs.lineCounts[f] & 0xF0000000)) // This means the first function always wins, which seems to be the behavior of the original Breakpad implementation
+			continue;
+
+		// First find the module specific file offset
+		uint32_t fileChk = fileIndex.at(block.file);
+
+		// Next get the unique id that is paired with that particular file
+		funcs.fileIndices[f] = unique.at(fileChk).id;
+
+		funcs.lineCounts[f] = block.count;
+		funcs.lineOffsets[f] = block.offset;
+
+		if (block.count)
+		{
+			reader.seek(block.linesAt);
+			funcs.lines[f] = reader.read<uint8_t>(block.count * sizeof(CV_Line));
+		}
+
+		// Mark that the function has been encountered
+		funcs.lineCounts[f] |= 0xF0000000;
+	}
 }
 
 void
-PDBParser::printFunctions(Functions& funcs, const TypeMap& tm, FILE* of)
+PDBParser::printFunctions(FunctionTable& funcs, const TypeTable& tm, TypeNameCache* names, ChunkWriter& out)
 {
-	std::string str;
-	str.reserve(2048);
+	const size_t FunctionsPerChunk = 512;
+	size_t tasks = Concurrency::GetProcessorCount();
+
+	// Chunks are kept small enough that a few of them can be waiting on the
+	// writer at once, but there are enough of them to keep every task busy
+	size_t perChunk = std::min<size_t>(std::max<size_t>(funcs.size() / (tasks * 4), 16), FunctionsPerChunk);
+	size_t chunks = (funcs.size() + perChunk - 1) / perChunk;
+	if (chunks == 0)
+		return;
+
+	size_t first = out.Claim(chunks);
+
+	auto formatChunk = [this, &funcs, &tm, names, &out, first, perChunk](size_t c, std::string& str, std::string& temp) {
+		std::string chunk;
+		try
+		{
+			// What was read is always written when truncating, formatting
+			// only takes as long as reading it did
+			if (!truncating())
+				checkBudget();
+
+			formatFunctions(funcs, c * perChunk, std::min((c + 1) * perChunk, funcs.size()), tm, names, chunk, str, temp);
+		}
+		catch (...)
+		{
+			// This chunk is never going to arrive, so nothing after it can be
+			// written, and tasks waiting for room to write them are let go
+			out.Cancel();
+			throw;
+		}
+		out.Write(first + c, std::move(chunk));
+	};
+
+	tasks = std::min(tasks, chunks);
+	if (tasks <= 1)
+	{
+		std::string str, temp;
+		for (size_t c = 0; c < chunks; ++c)
+			formatChunk(c, str, temp);
+		return;
+	}
 
-	std::string temp;
-	str.reserve(1024);
+	// Chunks are handed out in order, so the chunk the writer is waiting on
+	// is always one that a task is already formatting. Tasks that get too
+	// far ahead of it block in Write until it catches up.
+	std::atomic<size_t> next(0);
+
+	Concurrency::task_group ftg;
+	for (size_t t = 0; t < tasks; ++t)
+	{
+		ftg.run([&next, &formatChunk, chunks]() {
+			std::string str, temp;
+			for (size_t c = next++; c < chunks; c = next++)
+				formatChunk(c, str, temp);
+		});
+	}
+	ftg.wait();
+}
 
-	for (auto& func : funcs)
+void
+PDBParser::formatFunctions(const FunctionTable& funcs, size_t first, size_t last, const TypeTable& tm, TypeNameCache* names,
+	std::string& out, std::string& str, std::string& temp)
+{
+	for (size_t f = first; f < last; ++f)
 	{
 		str.clear();
 
-		if (func.segment == 0xffffffff)
+		if (funcs.skipped(f))
 			continue;
 
-		if (func.typeIndex)
+		uint32_t offset = funcs.offset(f);
+		uint32_t length = funcs.lengths[f];
+		if (uint32_t typeIndex = funcs.typeIndices[f])
 		{
-			stringizeType(func.typeIndex, str, tm, IsTopLevel);
+			try
+			{
+				stringizeType(typeIndex, str, tm, names, IsTopLevel, m_budget.maxTypeDepth ? m_budget.maxTypeDepth : ~0u);
+			}
+			catch (BudgetExceeded&)
+			{
+				const char* none = nullptr;
+				m_budgetReason.compare_exchange_strong(none, "Types are nested too deeply");
+				if (!truncating())
+					throw;
+				str.clear();
+			}
 
-			temp.assign(func.name.data);
+			temp.assign(funcs.names[f].data);
 			std::string::size_type pos;
 			while ((pos = temp.rfind(" __ptr64")) != std::string::npos)
 			{
@@ -1332,38 +3099,38 @@ PDBParser::printFunctions(Functions& funcs, const TypeMap& tm, FILE* of)
 				temp.erase(pos, 7);
 			}
 
-			fprintf(of, "FUNC %x %x %x %s%s\n", func.offset, func.length, func.paramSize, temp.c_str(), str.c_str());
+			appendFormat(out, "FUNC %x %x %x %s%s\n", offset, length, funcs.paramSizes[f], temp.c_str(), str.c_str());
 
-			uint32_t lineCount = func.lineCount & 0x0FFFFFFF;
+			uint32_t lineCount = funcs.lineCounts[f] & 0x0FFFFFFF;
 			if (lineCount)
 			{
-				const CV_Line* lines = (const CV_Line*)func.lines.data;
+				const CV_Line* lines = (const CV_Line*)funcs.lines[f].data;
 				uint32_t fromNext = lineCount - 1;
 
 				// Handle rare case where the last line offset exceeds the actual function length,
 				// have only encountered this with '__security_check_cookie()'
 				uint32_t modifier = 0;
-				if (lines[fromNext].offset > func.length)
+				if (lines[fromNext].offset > length)
 				{
-					modifier = lines[fromNext].offset - func.length;
+					modifier = lines[fromNext].offset - length;
 					if (uint32_t diff = modifier % 16)
 						modifier = modifier + 16 - diff;
 				}
 
 				for (uint32_t i = 0; i < lineCount; ++i)
 				{
-					uint32_t size = i < fromNext ? lines[i + 1].offset - lines[i].offset : func.length + modifier - lines[i].offset;
-					fprintf(of, "%x %x %u %u\n", lines[i].offset + func.offset - modifier, size, lines[i].flags & CV_Line_Flags::linenumStart, func.fileIndex);
+					uint32_t size = i < fromNext ? lines[i + 1].offset - lines[i].offset : length + modifier - lines[i].offset;
+					appendFormat(out, "%x %x %u %u\n", lines[i].offset + offset - modifier, size, lines[i].flags & CV_Line_Flags::linenumStart, funcs.fileIndices[f]);
 				}
 			}
 		}
-		else if (func.length)
+		else if (length)
 		{
-			fprintf(of, "FUNC %x %x %x %s\n", func.offset, func.length, func.paramSize, func.name.data);
+			appendFormat(out, "FUNC %x %x %x %s\n", offset, length, funcs.paramSizes[f], funcs.names[f].data);
 		}
 		else
 		{
-			fprintf(of, "PUBLIC %x %x %s\n", func.offset, func.paramSize, func.name.data);
+			appendFormat(out, "PUBLIC %x %x %s\n", offset, funcs.paramSizes[f], funcs.names[f].data);
 		}
 	}
 }
@@ -1374,7 +3141,7 @@ PDBParser::readFPO(uint32_t fpoStream, std::map<std::pair<uint32_t, uint32_t>, D
 {
 	auto& fs = getStream(fpoStream);
 
-	StreamReader reader(fs, *this);
+	StreamReader reader(fs, *this, 0, arena(m_arena));
 
 	T last = {};
 	while (reader.getOffset() < fs.size)
@@ -1391,25 +3158,25 @@ PDBParser::readFPO(uint32_t fpoStream, std::map<std::pair<uint32_t, uint32_t>, D
 
 template<typename T>
 bool
-PDBParser::updateParamSize(FunctionRecord& func, std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData)
+PDBParser::updateParamSize(FunctionTable& funcs, size_t f, std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData)
 {
-	auto p = std::make_pair(func.offset, func.length);
+	auto p = std::make_pair(funcs.offset(f), funcs.lengths[f]);
 	auto it = fpoData.find(p);
 	if (it != fpoData.end())
 	{
-		updateParamSize(func, *it->second.data);
+		updateParamSize(funcs, f, *it->second.data);
 		return true;
 	}
 	return false;
 }
 
 bool
-PDBParser::updateParamSize(FunctionRecord& func, Globals& globals)
+PDBParser::updateParamSize(FunctionTable& funcs, size_t f, Globals& globals)
 {
-	auto g = globals.find(func.offset);
+	auto g = globals.find(funcs.offset(f));
 	if (g != globals.end())
 	{
-		const char* name = g->second.data;
+		const char* name = g->second;
 		// stdcall and fastcall functions have their param size embedded in the decorated name
 		if (name[0] == '@' || name[0] == '_')
 		{
@@ -1420,17 +3187,18 @@ PDBParser::updateParamSize(FunctionRecord& func, Globals& globals)
 				long val = strtol(p + 1, &end, 10);
 				if (*end == '\0')
 				{
-					func.paramSize = val;
+					uint32_t& paramSize = funcs.paramSizes[f];
+					paramSize = val;
 					// fastcall functions accept up to 8 bytes of parameters in registers
 					if (name[0] == '@')
 					{
 						if (val > 8)
 						{
-							func.paramSize -= 8;
+							paramSize -= 8;
 						}
 						else
 						{
-							func.paramSize = 0;
+							paramSize = 0;
 						}
 					}
 					return true;
@@ -1442,51 +3210,96 @@ PDBParser::updateParamSize(FunctionRecord& func, Globals& globals)
 }
 
 void
-PDBParser::updateParamSize(FunctionRecord& func, const FPO_DATA& fpoData)
+PDBParser::updateParamSize(FunctionTable& funcs, size_t f, const FPO_DATA& fpoData)
 {
-	func.paramSize = fpoData.cdwParams * 4;
+	funcs.paramSizes[f] = fpoData.cdwParams * 4;
 }
 
 void
-PDBParser::updateParamSize(FunctionRecord& func, const FPO_DATA_V2& fpoData)
+PDBParser::updateParamSize(FunctionTable& funcs, size_t f, const FPO_DATA_V2& fpoData)
 {
-	func.paramSize = fpoData.cbParams;
+	funcs.paramSizes[f] = fpoData.cbParams;
 }
 
 template<typename T>
 void
-PDBParser::printFPOs(std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData, const NameStream& names, FILE* of)
+PDBParser::printFPOs(std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData, const NameStream& names, ChunkWriter& out)
 {
+	std::string chunk;
 	for (auto& f : fpoData)
 	{
-		printFPO(*f.second.data, names, of);
+		if (chunk.size() >= ChunkWriter::ChunkSize)
+		{
+			out.Write(out.Claim(), std::move(chunk));
+			chunk.clear();
+		}
+
+		printFPO(*f.second.data, names, chunk);
 	}
+
+	if (!chunk.empty())
+		out.Write(out.Claim(), std::move(chunk));
 }
 
 void
-PDBParser::printFPO(const FPO_DATA& data, const NameStream& names, FILE* of)
+PDBParser::printFPO(const FPO_DATA& data, const NameStream& names, std::string& out)
 {
 	(void)names;
-	fprintf(of, "STACK WIN 0 %x %x %x %x %x %x %x %x 0 %d\n",
+	appendFormat(out, "STACK WIN 0 %x %x %x %x %x %x %x %x 0 %d\n",
 	data.ulOffStart, data.cbProcSize, data.cbProlog, 0, data.cdwParams, data.cbRegs, data.cdwLocals, 0, data.fUseBP);
 }
 
 void
-PDBParser::printFPO(const FPO_DATA_V2& data, const NameStream& names, FILE* of)
+PDBParser::printFPO(const FPO_DATA_V2& data, const NameStream& names, std::string& out)
 {
-	fprintf(of, "STACK WIN 4 %x %x %x %x %x %x %x %x 1 ",
+	appendFormat(out, "STACK WIN 4 %x %x %x %x %x %x %x %x 1 ",
 		data.ulOffStart, data.cbProcSize, data.cbProlog, 0, data.cbParams, data.cbSavedRegs, data.cbLocals, data.maxStack);
 	auto iter = names.map.find(data.ProgramStringOffset);
 	if (iter != names.map.end())
 	{
-		fprintf(of, "%s", iter->second.data);
+		out.append(iter->second.data);
+	}
+	out.append("\n", 1);
+}
+
+bool
+PDBParser::TypeNameCache::find(uint32_t type, uint32_t flags, std::string& output, bool& result)
+{
+	Shard& s = shard(type);
+	{
+		std::lock_guard<std::mutex> lock(s.lock);
+
+		auto it = s.entries.find(((uint64_t)type << 32) | flags);
+		if (it != s.entries.end())
+		{
+			output += it->second.text;
+			result = it->second.result;
+			++m_hits;
+			return true;
+		}
 	}
-	fprintf(of, "\n");
+
+	++m_misses;
+	return false;
+}
+
+void
+PDBParser::TypeNameCache::insert(uint32_t type, uint32_t flags, const char* text, size_t length, bool result)
+{
+	Shard& s = shard(type);
+	std::lock_guard<std::mutex> lock(s.lock);
+
+	Entry entry = { std::string(text, length), result };
+	s.entries.emplace(((uint64_t)type << 32) | flags, std::move(entry));
 }
 
 bool
-PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm, uint32_t flags)
+PDBParser::stringizeType(uint32_t type, std::string& output, const TypeTable& tm, TypeNameCache* names,
+	uint32_t flags, uint32_t depth)
 {
+	if (depth == 0)
+		throw BudgetExceeded("Types are nested too deeply");
+
 	if (type == 0)
 	{
 		output.append("...", 3);
@@ -1494,7 +3307,7 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 	}
 
 	auto ti = tm.find(type);
-	if (ti == tm.end())
+	if (!ti)
 	{
 		switch (type & 0xff)
 		{
@@ -1591,15 +3404,35 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 		return false;
 	}
 
-	const uint8_t* data = ti->second.data.data;
+	if (!names)
+		return stringizeRecord(*ti, output, tm, names, flags, depth);
+
+	// Argument lists and the types in them are shared by lots of functions,
+	// so each is only walked the first time
+	bool result;
+	if (names->find(type, flags, output, result))
+		return result;
+
+	size_t mark = output.size();
+	result = stringizeRecord(*ti, output, tm, names, flags, depth);
+	names->insert(type, flags, output.data() + mark, output.size() - mark, result);
+	return result;
+}
+
+bool
+PDBParser::stringizeRecord(const TypeInfo& ti, std::string& output, const TypeTable& tm,
+	TypeNameCache* names, uint32_t flags, uint32_t depth)
+{
+	auto record = tm.record(ti);
+	const uint8_t* data = record.data;
 
-	switch (ti->second.type)
+	switch ((LEAF::Enum)ti.type)
 	{
 		// const/volatile/unaligned
 	case LEAF::LF_MODIFIER:
 		{
 			const LeafModifier* lm = (const LeafModifier*)data;
-			stringizeType(lm->type, output, tm, 0);
+			stringizeType(lm->type, output, tm, names, 0, depth - 1);
 
 			if (flags & (IsUnderlying | ~IsTopLevel))
 				return false;
@@ -1633,7 +3466,7 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 			const uint32_t* type = (const uint32_t*)lal;
 			for (uint32_t i = 0; i < lal->count; ++i)
 			{
-				stringizeType(*++type, output, tm, flags);
+				stringizeType(*++type, output, tm, names, flags, depth - 1);
 
 				if (i != lal->count - 1)
 					output.append(",", 1);
@@ -1647,7 +3480,7 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 		{
 			const LeafPointer* lp = (const LeafPointer*)data;
 
-			if (!stringizeType(lp->utype, output, tm, IsUnderlying & flags))
+			if (!stringizeType(lp->utype, output, tm, names, IsUnderlying & flags, depth - 1))
 			{
 				switch ((lp->attr & LeafPointerAttr::ptrmode) >> 5)
 				{
@@ -1685,14 +3518,14 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 		{
 			const LeafArray* la = (const LeafArray*)data;
 
-			stringizeType(la->elemtype, output, tm, 0);
+			stringizeType(la->elemtype, output, tm, names, 0, depth - 1);
 
 			output.append("[", 1);
 			// According to the comments, if this value is less than 0x8000 then the next 2 bytes are the actual value
 			if (la->idxtype < 0x8000)
 				output += std::to_string(*((uint16_t*)(data + sizeof(LeafArray))));
 			else
-				stringizeType(la->idxtype, output, tm, 0);
+				stringizeType(la->idxtype, output, tm, names, 0, depth - 1);
 			output.append("]", 1);
 		}
 		break;
@@ -1702,13 +3535,13 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 
 			if (flags & IsUnderlying)
 			{
-				stringizeType(lmf->rvtype, output, tm, 0);
+				stringizeType(lmf->rvtype, output, tm, names, 0, depth - 1);
 				output.append(" (", 2);
-				stringizeType(lmf->classtype, output, tm, 0);
+				stringizeType(lmf->classtype, output, tm, names, 0, depth - 1);
 				output.append("::*)", 4);
 			}
 
-			stringizeType(lmf->arglist, output, tm, 0);
+			stringizeType(lmf->arglist, output, tm, names, 0, depth - 1);
 		}
 		return true;
 	case LEAF::LF_PROCEDURE:
@@ -1717,17 +3550,17 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 
 			if (flags & IsUnderlying)
 			{
-				stringizeType(proc->rvtype, output, tm, 0);
+				stringizeType(proc->rvtype, output, tm, names, 0, depth - 1);
 				output.append(" (*)", 4);
 			}
 
-			stringizeType(proc->arglist, output, tm, 0);
+			stringizeType(proc->arglist, output, tm, names, 0, depth - 1);
 		}
 		return true;
 	case LEAF::LF_INDEX:
 		{
 			const LeafIndex* li = (const LeafIndex*)data;
-			stringizeType(li->index, output, tm, flags);
+			stringizeType(li->index, output, tm, names, flags, depth - 1);
 		}
 		break;
 		// All types past this point are leaf types that terminate recursion
@@ -1737,7 +3570,7 @@ PDBParser::stringizeType(uint32_t type, std::string& output, const TypeMap& tm,
 	case LEAF::LF_CLASS:
 	case LEAF::LF_STRUCTURE:
 		{
-			output += ti->second.name.data;
+			output += (const char*)data;
 		}
 		break;
 	case LEAF::LF_CHAR:
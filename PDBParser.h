@@ -23,13 +23,23 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <stdint.h>
 #include <vector>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <stdlib.h>
+#include <string.h>
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
@@ -47,6 +57,8 @@ namespace google_breakpad
 
 typedef IMAGE_SECTION_HEADER SectionHeader;
 class StreamReader;
+class Prefetcher;
+class ChunkWriter;
 
 template<typename T>
 struct DataPtr
@@ -95,36 +107,480 @@ private:
 	DataPtr& operator =(const DataPtr&) { return *this; }
 };
 
+// Hands out the memory that records which have to be copied out of the file
+// are copied into, carved out of big chunks instead of one heap block each.
+// Nothing is freed until the arena is reset or destroyed, and DataPtrs into it
+// don't own their data. Not thread safe, every thread needs its own.
+class Arena
+{
+public:
+	explicit Arena(size_t chunkSize = 64 * 1024)
+		: m_chunkSize(chunkSize)
+		, m_chunk(0)
+		, m_used(0)
+		, m_allocations(0)
+		, m_heapBlocks(0)
+		, m_counter(nullptr)
+	{}
+
+	void* allocate(size_t size)
+	{
+		++m_allocations;
+		size = (std::max<size_t>(size, 1) + Alignment - 1) & ~(Alignment - 1);
+
+		// Records big enough to waste most of a chunk get a block of their own
+		if (size > m_chunkSize / 4)
+		{
+			++m_heapBlocks;
+			if (m_counter)
+				m_counter->fetch_add(size, std::memory_order_relaxed);
+			m_large.emplace_back(new uint8_t[size]);
+			return m_large.back().get();
+		}
+
+		if (m_chunk >= m_chunks.size() || m_used + size > m_chunkSize)
+		{
+			if (m_chunk < m_chunks.size())
+				++m_chunk;
+
+			if (m_chunk == m_chunks.size())
+			{
+				++m_heapBlocks;
+				m_chunks.emplace_back(new uint8_t[m_chunkSize]);
+			}
+
+			m_used = 0;
+		}
+
+		// Counted a chunk at a time, every thread adding to the same counter
+		// for every record would have them fighting over it
+		if (m_used == 0 && m_counter)
+			m_counter->fetch_add(m_chunkSize, std::memory_order_relaxed);
+
+		uint8_t* block = m_chunks[m_chunk].get() + m_used;
+		m_used += size;
+		return block;
+	}
+
+	// Adds the bytes taken into use from now on to counter, which can be
+	// shared by arenas on different threads
+	void setCounter(std::atomic<uint64_t>* counter) { m_counter = counter; }
+
+	// Everything handed out so far is invalid after this. The chunks are kept
+	// to be handed out again.
+	void reset()
+	{
+		m_large.clear();
+		m_chunk = 0;
+		m_used = 0;
+	}
+
+	// Calls to allocate, and how many of them had to go to the heap
+	uint64_t Allocations() const { return m_allocations; }
+	uint64_t HeapBlocks() const { return m_heapBlocks; }
+
+private:
+	enum { Alignment = 8 };
+
+	size_t									m_chunkSize;
+	std::vector<std::unique_ptr<uint8_t[]>>	m_chunks;
+	std::vector<std::unique_ptr<uint8_t[]>>	m_large;
+	size_t									m_chunk;	//!< The chunk being handed out from
+	size_t									m_used;		//!< Bytes of it already handed out
+	uint64_t								m_allocations;
+	uint64_t								m_heapBlocks;
+	std::atomic<uint64_t>*					m_counter;
+};
+
+// Keeps every distinct string once, known by an id that's the same for every
+// copy of it, so that strings can be compared by id. Strings that live as long
+// as the pool are pointed at instead of copied, only the rest go into its
+// arenas. Any number of threads can intern at once.
+class StringPool
+{
+public:
+	struct String
+	{
+		const char*	data;
+		uint32_t	id;
+	};
+
+	StringPool()
+		: m_lookups(0)
+	{}
+
+	// str has to stay valid as long as the pool does unless it's copied
+	String intern(const char* str, size_t length, bool copy);
+
+	// Everything interned so far is invalid after this. The tables and arenas
+	// are kept to be used again.
+	void reset();
+
+	// Adds the bytes of copied strings to counter
+	void setCounter(std::atomic<uint64_t>* counter);
+
+	// Calls to intern, and how many different strings they were for
+	uint64_t Lookups() const { return m_lookups; }
+	uint64_t Strings() const;
+
+private:
+	enum { ShardBits = 6, Shards = 1 << ShardBits };
+
+	struct Entry
+	{
+		const char*	data;	//!< Null if the slot is free
+		uint32_t	length;
+		uint32_t	hash;	//!< The low bits, which pick the slot
+		uint32_t	id;
+	};
+
+	// Strings are spread over shards by the top bits of their hash, so that
+	// threads interning different strings rarely wait on each other
+	struct Shard
+	{
+		Shard() : count(0) {}
+
+		mutable std::mutex	lock;
+		std::vector<Entry>	slots;	//!< Open addressing, a power of 2 of them
+		uint32_t			count;
+		Arena				arena;
+	};
+
+	static void grow(Shard& shard);
+
+	Shard					m_shards[Shards];
+	std::atomic<uint64_t>	m_lookups;
+};
+
+// Limits on what one printBreakpadSymbols can take, so that a pathological PDB
+// can't stall whoever is waiting on it. 0 is no limit for all of them.
+struct ParseBudget
+{
+	double		seconds;		//!< From the start of printBreakpadSymbols
+	uint64_t	maxBytes;		//!< Of records copied out of the file, which arenas have to be on for
+	uint32_t	maxTypeDepth;	//!< How deep naming a function's type can recurse
+
+	enum Partial
+	{
+		// Throw BudgetExceeded, leaving whatever was already written
+		Abort,
+		// Stop reading, but still write the symbols of what was read. A type
+		// that is nested too deeply only loses the function its signature.
+		Truncate,
+	};
+	Partial		partial;
+
+	ParseBudget()
+		: seconds(0)
+		, maxBytes(0)
+		, maxTypeDepth(0)
+		, partial(Abort)
+	{}
+};
+
+class BudgetExceeded : public std::runtime_error
+{
+public:
+	explicit BudgetExceeded(const char* reason) : std::runtime_error(reason) {}
+};
+
 class MMapWrapper
 {
 public:
 	MMapWrapper() :
 #ifdef _WIN32
 		m_mapFile(0),
-#else
-		m_length(0),
 #endif
-		m_base(nullptr)
+		m_length(0)
+		, m_base(nullptr)
+		, m_decompressed(false)
+		, m_readAhead(0)
+		, m_advised(0)
 	{}
 
+	// gzip and zstd compressed files are decompressed into anonymous memory
+	// instead of being mapped, which nothing reading from base can tell apart
 	bool Map(const char* filename);
 	bool Unmap();
 	bool Valid()
 	{
 #ifdef _WIN32
-		return m_mapFile != nullptr && m_base != nullptr;
+		return (m_mapFile != nullptr || m_decompressed) && m_base != nullptr;
 #else
 		return m_base != nullptr;
 #endif
 	}
 	const uint8_t* base() const { return m_base; }
+	// base is not the file itself, so it can't be read some other way
+	bool IsDecompressed() const { return m_decompressed; }
+
+	// Whether the file starts with the magic number of a format Map decompresses
+	static bool IsCompressed(const char* filename);
+
+	// A byte range of the mapped file
+	struct Range
+	{
+		uint64_t	offset;
+		uint64_t	size;
+	};
+
+	// Every step is the page runs of the stream(s) that will be read next, in
+	// the order the parser is going to get to them
+	typedef std::vector<std::vector<Range>> AccessPlan;
+
+	// Hints are only given to the OS once a plan is set, readAhead is how many
+	// steps past the current one should be paged in ahead of time
+	void SetAccessPlan(AccessPlan plan, size_t readAhead);
+	// The parser is starting to read the step's streams. Pages aren't dropped
+	// once a step is done, names still point into them until they're printed.
+	void BeginStep(size_t step);
+	// Asks the OS to page the ranges in ahead of them being read
+	void WillNeed(const std::vector<Range>& ranges);
 private:
+	// Swaps the mapping for a decompressed copy of the file
+	bool decompress();
+	void unmapFile();
+
 #ifdef _WIN32
 	HANDLE			m_mapFile;
-#else
-	size_t			m_length;
 #endif
+	size_t			m_length;
 	const uint8_t*	m_base;
+	bool			m_decompressed;
+
+	AccessPlan		m_plan;
+	size_t			m_readAhead;
+	size_t			m_advised;		//!< Steps before this have already been asked for
+};
+
+// Reads MSF pages with pread into a bounded LRU cache, as an alternative to
+// mapping the whole file, which can be slow or raise SIGBUS on network filesystems
+class PageCache
+{
+public:
+	PageCache()
+#ifdef _WIN32
+		: m_file(INVALID_HANDLE_VALUE)
+#else
+		: m_fd(-1)
+#endif
+		, m_pageSize(0)
+		, m_capacity(0)
+		, m_hits(0)
+		, m_misses(0)
+	{}
+
+	~PageCache() { Close(); }
+
+	// capacity is the most memory the cached pages may take up, in bytes
+	bool Open(const char* filename, size_t capacity);
+	void Close();
+	bool Valid() const
+	{
+#ifdef _WIN32
+		return m_file != INVALID_HANDLE_VALUE;
+#else
+		return m_fd != -1;
+#endif
+	}
+
+	// Only known once the header has been read
+	void SetPageSize(uint32_t pageSize);
+
+	// Reads straight from the file, bypassing the cache
+	bool Read(uint64_t offset, void* out, size_t size) const;
+
+	// The page stays valid for as long as the returned pointer is held, even if
+	// it has been evicted in the meantime
+	std::shared_ptr<const uint8_t> GetPage(uint32_t index);
+
+	uint64_t Hits() const { return m_hits; }
+	uint64_t Misses() const { return m_misses; }
+private:
+	typedef std::shared_ptr<const uint8_t> Page;
+
+	struct Entry
+	{
+		Page							page;
+		std::list<uint32_t>::iterator	lru;
+	};
+
+#ifdef _WIN32
+	HANDLE			m_file;
+#else
+	int				m_fd;
+#endif
+	uint32_t		m_pageSize;
+	size_t			m_capacity;		//!< In pages
+
+	std::mutex							m_lock;
+	std::list<uint32_t>					m_lru;		//!< Most recently used at the front
+	std::unordered_map<uint32_t, Entry>	m_pages;
+	uint64_t							m_hits;
+	uint64_t							m_misses;
+};
+
+// Maps the file a window at a time rather than all at once, so that a PDB of any
+// size can be read within a fixed budget of address space, 32 bit processes
+// included. Windows that are still in use stay mapped, past the budget if need
+// be, until nothing is using them any more.
+class WindowedMapping
+{
+public:
+	WindowedMapping()
+#ifdef _WIN32
+		: m_mapFile(nullptr)
+#else
+		: m_fd(-1)
+#endif
+		, m_fileSize(0)
+		, m_granularity(0)
+		, m_budget(0)
+		, m_pageSize(0)
+		, m_windowSize(0)
+		, m_capacity(0)
+		, m_maps(0)
+	{}
+
+	~WindowedMapping() { Close(); }
+
+	// budget is how much address space the windows may take up, in bytes
+	bool Open(const char* filename, size_t budget);
+	void Close();
+	bool Valid() const
+	{
+#ifdef _WIN32
+		return m_mapFile != nullptr;
+#else
+		return m_fd != -1;
+#endif
+	}
+
+	// Windows are always a whole number of pages, which is only known once the
+	// header has been read
+	void SetPageSize(uint32_t pageSize);
+
+	// Gets up to count pages starting at page, and sets count to how many of
+	// them are in the same window. They stay mapped for as long as pin is held.
+	const uint8_t* GetPages(uint32_t page, uint32_t& count, std::shared_ptr<const void>& pin);
+	bool Read(uint64_t offset, void* out, size_t size);
+
+	uint64_t WindowSize() const { return m_windowSize; }
+	// How many times a window had to be mapped
+	uint64_t Maps() const { return m_maps; }
+private:
+	struct Window;
+	typedef std::shared_ptr<const Window> WindowPtr;
+
+	WindowPtr getWindow(uint64_t index);
+	// Splits the budget up into windows that are a multiple of unit
+	void sizeWindows(uint64_t unit);
+
+	struct Entry
+	{
+		WindowPtr						window;
+		std::list<uint64_t>::iterator	lru;
+	};
+
+#ifdef _WIN32
+	HANDLE			m_mapFile;
+#else
+	int				m_fd;
+#endif
+	uint64_t		m_fileSize;
+	uint64_t		m_granularity;	//!< Windows have to start at a multiple of this
+	size_t			m_budget;
+	uint32_t		m_pageSize;
+	uint64_t		m_windowSize;	//!< A multiple of both the page size and the granularity
+	size_t			m_capacity;		//!< In windows
+
+	std::mutex							m_lock;
+	std::list<uint64_t>					m_lru;		//!< Most recently used at the front
+	std::unordered_map<uint64_t, Entry>	m_windows;
+	uint64_t							m_maps;
+};
+
+// Reads an MSF front to back from a pipe, or anything else that can't be seeked
+// or mapped, on a thread of its own. Pages are handed out as soon as they have
+// arrived, so the parser can get going while the rest of the file is still coming
+// in. Nothing can be known about a page until the directory has been read, so
+// every page is kept until the parser says which ones it needs.
+class PipeReader
+{
+public:
+	PipeReader()
+		: m_fd(-1)
+		, m_pageSize(0)
+		, m_received(0)
+		, m_done(false)
+		, m_failed(false)
+	{}
+
+	~PipeReader() { Close(); }
+
+	// The fd is read until the end of the input, but is never closed
+	bool Open(int fd);
+	// Waits for the rest of the input to be drained, so whoever is writing it
+	// never sees a broken pipe
+	void Close();
+	bool Valid() const { return m_fd != -1; }
+
+	// Both of these wait for the pages they need to arrive
+	bool Read(uint64_t offset, void* out, size_t size) const;
+	std::shared_ptr<const uint8_t> GetPage(uint32_t index) const;
+
+	// Frees every page that isn't flagged, and stops any more of them from
+	// being kept as they arrive
+	void Retain(const std::vector<bool>& pages);
+
+	uint32_t PagesReceived() const;
+	uint32_t PagesKept() const;
+private:
+	typedef std::shared_ptr<std::vector<uint8_t>> Page;
+
+	void readPages();
+	bool readAll(uint8_t* out, size_t size);
+	// Waits for the page, false if the input ended before it arrived
+	bool waitFor(uint32_t index, std::unique_lock<std::mutex>& lock) const;
+
+	int							m_fd;
+	std::thread					m_thread;
+
+	mutable std::mutex			m_lock;
+	mutable std::condition_variable	m_arrived;
+	std::vector<Page>			m_pages;	//!< Null if the page was dropped
+	std::vector<bool>			m_keep;		//!< Empty until Retain is called, then only these are kept
+	uint32_t					m_pageSize;	//!< 0 until the header has arrived
+	uint32_t					m_received;
+	bool						m_done;
+	bool						m_failed;	//!< The header was invalid or the input couldn't be read
+};
+
+// A whole stream as one block of contiguous memory. This either points straight
+// into the mapping, when all of the stream's pages are adjacent, or into a copy
+// that is shared by every view of the stream.
+class StreamView
+{
+public:
+	StreamView()
+		: m_data(nullptr)
+		, m_size(0)
+	{}
+
+	StreamView(const uint8_t* data, uint32_t size, std::shared_ptr<const void> owner = nullptr)
+		: m_data(data)
+		, m_size(size)
+		, m_owner(std::move(owner))
+	{}
+
+	const uint8_t* data() const { return m_data; }
+	uint32_t size() const { return m_size; }
+	bool isMapped() const { return !m_owner; }
+
+private:
+	const uint8_t*				m_data;
+	uint32_t					m_size;
+	std::shared_ptr<const void>	m_owner;	//!< Keeps the copied stream alive, null if mapped
 };
 
 class PDBParser
@@ -133,12 +589,25 @@ public:
 
 	PDBParser()
 		: m_base(nullptr)
+		, m_pageCacheSize(0)
+		, m_windowBudget(0)
+		, m_prefetchDepth(0)
+		, m_decodeTasks(0)
 		, m_foundPE(false)
+		, m_useAccessPlan(true)
+		, m_useArena(true)
+		, m_lazyTypes(false)
+		, m_typeStats()
+		, m_bytesAllocated(0)
+		, m_budgetReason(nullptr)
 	{}
 
 	~PDBParser() { close(); }
 
 	void load(const char* path);
+	// Reads the PDB from a pipe or other stream that can only be read in order.
+	// name is the PDB's file name, for the MODULE line and finding the exe.
+	void load(int fd, const char* name);
 
 	void close();
 
@@ -154,13 +623,90 @@ public:
 
 	void printBreakpadSymbols(FILE* of, const char* platform = nullptr, FileMod* file = nullptr);
 
+	// The GUID and age the PDB is known by, as on the MODULE line
+	std::string debugIdentifier();
+	// Where the symbols go in a Breakpad symbol store, <name>.pdb/<id>/<name>.sym
+	std::string symbolStorePath();
+
+	// Limits for every printBreakpadSymbols from now on
+	void setBudget(const ParseBudget& budget) { m_budget = budget; }
+	// Why the last printBreakpadSymbols went over its budget, null if it didn't
+	const char* budgetExceeded() const { return m_budgetReason; }
+
+	// Whether to tell the OS which parts of the file are going to be read next, on by default
+	void useAccessPlan(bool use) { m_useAccessPlan = use; }
+
+	// Whether types are only decoded once a function refers to them, which
+	// saves reading most of the type stream. Off by default, as a record
+	// without a type should hide every type after it, but the blocks after
+	// it are decoded without ever seeing it.
+	void useLazyTypes(bool use) { m_lazyTypes = use; }
+
+	struct TypeStats
+	{
+		uint32_t	types;
+		uint32_t	decoded;	//!< Records decoded, some more than once if chunks were thrown away
+		uint64_t	nameHits;	//!< Types stringized from the cache
+		uint64_t	nameMisses;
+	};
+	// The type records of the last printBreakpadSymbols
+	const TypeStats& typeStats() const { return m_typeStats; }
+	// The function and global names of the last printBreakpadSymbols
+	const StringPool& strings() const { return m_strings; }
+
+	// Whether records that have to be copied out of the file go into arenas
+	// instead of a heap block each, on by default
+	void useArena(bool use) { m_useArena = use; }
+
+	// Read the file through a page cache of at most this many bytes instead of
+	// mapping it, must be called before load. 0, the default, maps the file.
+	void usePageCache(size_t bytes) { m_pageCacheSize = bytes; }
+	const PageCache& pageCache() const { return m_pageCache; }
+
+	// Map the file through windows that take up at most this many bytes of
+	// address space between them, must be called before load. 0, the default,
+	// maps the whole file.
+	void useWindowedMapping(size_t budget) { m_windowBudget = budget; }
+	const WindowedMapping& windowedMapping() const { return m_windows; }
+	const PipeReader& pipe() const { return m_pipe; }
+
+	// Read the streams of this many modules past the one being parsed in the
+	// background. 0, the default, turns prefetching off.
+	void usePrefetcher(size_t depth) { m_prefetchDepth = depth; }
+	// Null unless prefetching was used by the last printBreakpadSymbols
+	const Prefetcher* prefetcher() const { return m_prefetcher.get(); }
+
+	// Decode the modules on at most this many tasks. 0, the default, uses as
+	// many as there are threads to run them.
+	void useDecodeTasks(size_t tasks) { m_decodeTasks = tasks; }
+
 	const uint32_t pageSize() const { return m_pageSize; }
+	// The mapped file, null when it is read through the page cache
 	const uint8_t* data() const { return m_base; }
 
+	// Gets the data for up to count pages starting at page, and sets count to
+	// how many of them are contiguous in memory. The data is only guaranteed
+	// to stay valid for as long as pin is held.
+	const uint8_t* getPages(uint32_t page, uint32_t& count, std::shared_ptr<const void>& pin) const;
+
+	// Copies bytes from the file, however it is being accessed
+	void readFile(uint64_t offset, void* out, size_t size) const;
+
+	// A run of physically adjacent pages in a stream, so that a reader can go
+	// straight from a logical offset to the mapped data without walking the page list
+	struct PageRun
+	{
+		uint32_t	offset;	//!< Logical offset in the stream of the first byte of the run
+		uint32_t	size;	//!< Size of the run in bytes, always a whole number of pages
+		uint32_t	page;	//!< Index in the file of the first page of the run
+	};
+
 	struct StreamPair
 	{
 		uint32_t				size;
 		std::vector<uint32_t>	pageIndices;
+		std::vector<PageRun>	runs;		//!< Sorted by offset, built once when the root stream is read
+		std::vector<uint32_t>	pageRuns;	//!< Index into runs for every page of the stream
 
 		StreamPair(uint32_t size)
 			: size(size)
@@ -168,103 +714,238 @@ public:
 	};
 
 	const StreamPair& getStream(int index) const { return m_streams[index]; }
+	size_t streamCount() const { return m_streams.size(); }
+
+	// Gets a contiguous view of the stream, copying it at most once per parser
+	// if its pages are not adjacent in the file. Safe to call from multiple threads.
+	StreamView getStreamView(uint32_t index);
+
+	// Gets a reader for the stream. Views are used when the file is mapped,
+	// otherwise the stream is read through the page cache a page at a time.
+	// Records that have to be copied go into arena, or the heap if it is null
+	StreamReader openStream(uint32_t index, Arena* arena = nullptr);
 
 private:
 
+	// A procedure or thunk as a module's symbols have it
 	struct FunctionRecord
 	{
-		DataPtr<char>		name;
-		DataPtr<uint8_t>	lines;
-		uint32_t			lineCount;
+		StringPool::String	name;
 		uint32_t			segment;
 		uint32_t			offset;
-		uint32_t			fileIndex;
 		uint32_t			length;
-		uint32_t			lineOffset;
 		uint32_t			typeIndex;	// If this is non-zero, the function is a procedure, not a thunk (I don't know how to read thunk type info...)
-		uint32_t			paramSize;
+	};
 
-		FunctionRecord(uint32_t offset, uint32_t segment)
-			: segment(segment)
-			, offset(offset)
+	// The functions of every module, a column for each field, so that sorting
+	// them and finding them by address only has to go through the keys
+	struct FunctionTable
+	{
+		std::vector<uint64_t>			keys;		//!< segment << 32 | offset
+		std::vector<StringPool::String>	names;
+		std::vector<uint32_t>			lengths;
+		std::vector<uint32_t>			typeIndices;
+		std::vector<DataPtr<uint8_t>>	lines;
+		std::vector<uint32_t>			lineCounts;	//!< The top bits are set once a module's lines are found
+		std::vector<uint32_t>			lineOffsets;
+		std::vector<uint32_t>			fileIndices;
+		std::vector<uint32_t>			paramSizes;
+
+		size_t size() const { return keys.size(); }
+		uint32_t segment(size_t f) const { return (uint32_t)(keys[f] >> 32); }
+		uint32_t offset(size_t f) const { return (uint32_t)keys[f]; }
+		void setOffset(size_t f, uint32_t offset) { keys[f] = (keys[f] & ~0xffffffffull) | offset; }
+
+		// Duplicates are left in, but skipped when printing
+		void skip(size_t f) { keys[f] |= 0xffffffff00000000ull; }
+		bool skipped(size_t f) const { return segment(f) == 0xffffffff; }
+
+		void reserve(size_t count);
+		void add(const std::vector<FunctionRecord>& functions);
+
+		// By address, with a radix sort of the keys. Functions at the same
+		// address are then sorted by anything else that tells them apart, so
+		// that which one is kept doesn't depend on the order they were found in.
+		void sort();
+		// Puts every column in the order of the functions' indices in order
+		void permute(const std::vector<uint32_t>& order);
+	};
 
-		{}
+	// Where a type's record is in the type stream. Named types point at
+	// their name, the rest at the data after the leaf kind.
+	struct TypeInfo
+	{
+		uint32_t	offset;
+		uint32_t	size;	//!< From offset to the end of the record, or its name if that runs past it
+		uint16_t	type;	//!< The LEAF::Enum, 0 if there is no such type
 
-		FunctionRecord(DataPtr<char>&& iname)
-			: name(std::move(iname))
-			, lineCount(0)
-			, segment(0)
-			, offset(0)
-			, fileIndex(0)
-			, length(0)
-			, lineOffset(0)
-			, typeIndex(0)
-			, paramSize(0)
-		{}
+		TypeInfo() : offset(0), size(0), type(0) {}
+	};
+
+	// A run of type records that can be decoded without the ones before it
+	struct TypeChunk
+	{
+		uint32_t	first;	//!< Type index of the first record
+		uint32_t	offset;	//!< Where it is in the type stream
+	};
+
+	// Every type there is, found by its index less the first one. Records are
+	// read straight out of a view of the whole type stream when the file is
+	// mapped, otherwise through the pages of the stream one record at a time,
+	// so the stream is never copied whole. They are decoded either all up
+	// front or a block at a time as types in the block are looked up.
+	class TypeTable
+	{
+	public:
+		// Decodes the block'th block, called just once for each block
+		typedef std::function<void(size_t block)> Decoder;
 
-		bool operator <(const FunctionRecord& other) const
+		TypeTable() : m_stream(nullptr), m_parser(nullptr), m_min(0), m_decoded(0) {}
+
+		void reset(const StreamView& view, uint32_t min, uint32_t max)
 		{
-			if (segment != other.segment)
-				return segment < other.segment;
-			else if (offset != other.offset)
-				return offset < other.offset;
-			else
-			{
-				// This is merely to make the sort algorithm not throw a shit fit
-				// at this point we have no way to differentiate between two functions
-				// so we will have to let one of them 'win' after the sort is finished
-				return typeIndex < other.typeIndex;
-			}
+			m_view = view;
+			m_stream = nullptr;
+			m_parser = nullptr;
+			reset(min, max);
 		}
 
-		bool operator ==(const FunctionRecord& other) const
+		void reset(const StreamPair& stream, const PDBParser& parser, uint32_t min, uint32_t max)
 		{
-			return segment == other.segment && offset == other.offset;
+			m_view = StreamView();
+			m_stream = &stream;
+			m_parser = &parser;
+			reset(min, max);
 		}
 
-		FunctionRecord(FunctionRecord&& other)
+		// The same stream and types as another table, none of them decoded
+		void resetLike(const TypeTable& other)
 		{
-			*this = std::move(other);
+			m_view = other.m_view;
+			m_stream = other.m_stream;
+			m_parser = other.m_parser;
+			reset(other.min(), other.max());
 		}
 
-		FunctionRecord& operator =(FunctionRecord&& other);
+		// Forgets every type, but keeps reading the same stream
+		void reset(uint32_t min, uint32_t max)
+		{
+			m_min = min;
+			m_types.assign(max > min ? max - min : 0, TypeInfo());
+			m_blocks.clear();
+			m_once.reset();
+			m_decode = nullptr;
+			m_decoded = 0;
+		}
 
-	private:
+		// Leaves every block to decode until a type in it is first looked up.
+		// The first block has to start with the first type.
+		void setLazy(std::vector<TypeChunk> blocks, Decoder decode)
+		{
+			m_blocks = std::move(blocks);
+			m_once.reset(new std::once_flag[m_blocks.size()]);
+			m_decode = std::move(decode);
+		}
+
+		const TypeInfo* find(uint32_t type) const
+		{
+			uint32_t i = type - m_min;
+			if (type < m_min || i >= m_types.size())
+				return nullptr;
+			if (m_decode)
+				resolve(type);
+			return m_types[i].type != 0 ? &m_types[i] : nullptr;
+		}
+
+		TypeInfo& at(uint32_t type) { return m_types[type - m_min]; }
+		// The record, from info.offset on, copied only if the stream isn't mapped
+		DataPtr<uint8_t> record(const TypeInfo& info) const;
+		// Reads the stream the types are in
+		StreamReader reader() const;
+		uint32_t size() const { return m_stream ? m_stream->size : (uint32_t)m_view.size(); }
+		const std::vector<TypeChunk>& blocks() const { return m_blocks; }
+		uint32_t min() const { return m_min; }
+		uint32_t max() const { return m_min + (uint32_t)m_types.size(); }
+
+		// Forgets the types in [first, last)
+		void clear(uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = std::max(first, m_min); i < std::min(last, max()); ++i)
+				m_types[i - m_min] = TypeInfo();
+		}
+
+		// Takes the types in [first, last) from another table of the same stream
+		void copy(const TypeTable& from, uint32_t first, uint32_t last)
+		{
+			for (uint32_t i = first; i < last; ++i)
+				m_types[i - m_min] = from.m_types[i - from.m_min];
+		}
+
+		// How many records have been decoded
+		void addDecoded(uint32_t count) { m_decoded += count; }
+		uint32_t decoded() const { return m_decoded; }
 
-		FunctionRecord(){}
-		FunctionRecord(const FunctionRecord&) {}
-		FunctionRecord& operator =(const FunctionRecord&) { return *this; }
+	private:
+		void resolve(uint32_t type) const;
+
+		StreamView							m_view;
+		const StreamPair*					m_stream;	//!< Null when reading from m_view
+		const PDBParser*					m_parser;
+		uint32_t							m_min;
+		std::vector<TypeInfo>				m_types;
+		std::vector<TypeChunk>				m_blocks;
+		std::unique_ptr<std::once_flag[]>	m_once;		//!< One for every block
+		Decoder								m_decode;	//!< Null if every type was decoded up front
+		std::atomic<uint32_t>				m_decoded;
 	};
 
-	struct TypeInfo
+	// What types were stringized as, by type index and stringize flags, so
+	// that every function sharing an argument list or pointer type doesn't
+	// walk it again. Shared by all of the threads formatting functions.
+	class TypeNameCache
 	{
-		DataPtr<uint8_t>	data;
-		DataPtr<char>		name;
-		LEAF::Enum			type;
+	public:
+		TypeNameCache() : m_hits(0), m_misses(0) {}
 
-		TypeInfo() {}
+		// Appends what the type was stringized as to output, false if it
+		// hasn't been yet
+		bool find(uint32_t type, uint32_t flags, std::string& output, bool& result);
+		// Only the first of threads that stringized the same type keeps it
+		void insert(uint32_t type, uint32_t flags, const char* text, size_t length, bool result);
 
-		TypeInfo(TypeInfo&& ti)
-		{
-			*this = std::move(ti);
-		}
+		uint64_t hits() const { return m_hits; }
+		uint64_t misses() const { return m_misses; }
+
+	private:
+		enum { Shards = 64 };
 
-		TypeInfo& operator =(TypeInfo&& other)
+		struct Entry
 		{
-			std::swap(data, other.data);
-			std::swap(name, other.name);
-			std::swap(type, other.type);
+			std::string	text;
+			bool		result;	//!< What stringizeType returned
+		};
 
-			return *this;
-		}
+		// Each on a cache line of its own, so threads only contend on the lock
+		// when they hit the same shard
+		struct alignas(64) Shard
+		{
+			std::mutex								lock;
+			std::unordered_map<uint64_t, Entry>		entries;
+		};
 
-	private:
+		Shard& shard(uint32_t type) { return m_shards[(type * 2654435761u) >> 26]; }
 
-		TypeInfo(const TypeInfo&) {}
-		TypeInfo& operator =(const TypeInfo&) { return *this; }
+		Shard					m_shards[Shards];
+		std::atomic<uint64_t>	m_hits;
+		std::atomic<uint64_t>	m_misses;
 	};
 
 	bool readRootStream();
+	// Everything load does once the file can be read
+	void loadHeaders(const char* path);
+	// Lets the pipe reader drop every page that isn't in one of the streams
+	void retainStreams(const std::vector<int32_t>& streams);
+	void buildPageRuns(StreamPair& stream);
 
 	struct UniqueSrc
 	{
@@ -280,27 +961,102 @@ private:
 	typedef std::map<uint32_t, DataPtr<char>> NameMap;
 	typedef std::map<uint32_t, uint32_t> SrcFileIndex;
 	typedef std::unordered_map<uint32_t, UniqueSrc> UniqueSrcFiles;
-	typedef std::vector<FunctionRecord> Functions;
-	typedef std::unordered_map<uint32_t, TypeInfo> TypeMap;
 	typedef std::vector<SectionHeader> SectionHeaders;
-	typedef std::unordered_map<uint32_t, DataPtr<char>> Globals;
+	typedef std::unordered_map<uint32_t, const char*> Globals;
 	// If we decide to only support VC2013 we can use this.
 	//template<typename T>
 	//using FPODataMap = std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>;
 
 	struct NameStream
 	{
-		NameMap map;
-		char*	buffer;
+		NameMap		map;
+		StreamView	view;
+	};
 
-		NameStream() : buffer(nullptr){}
-		~NameStream() { delete [] buffer; }
+	// Reads everything that's needed from a module stream in a single pass over it
+	struct ModuleDecoder
+	{
+		struct FileChecksum
+		{
+			uint32_t	offset;		//!< Offset from the start of the checksums, what line blocks refer to files by
+			uint32_t	name;		//!< Offset of the file's name in the name stream
+		};
+
+		struct LineBlock
+		{
+			uint32_t			segment;
+			uint32_t			offset;
+			uint32_t			file;	//!< The FileChecksum::offset of the block's file
+			uint32_t			count;
+			uint32_t			linesAt;	//!< Where the block's count CV_Lines are in the module stream
+
+			LineBlock(uint32_t segment, uint32_t offset)
+				: segment(segment)
+				, offset(offset)
+				, file(0)
+				, count(0)
+				, linesAt(0)
+			{}
+		};
+
+		int32_t						stream;		//!< The module stream, which the lines are only read from once resolved
+		std::vector<FunctionRecord>	functions;	//!< Procedures and thunks, in the order they appear
+		std::vector<FileChecksum>	files;
+		std::vector<LineBlock>		lines;
+
+		ModuleDecoder()
+			: stream(-1)
+		{}
+
+		void decode(PDBParser& parser, const DBIModuleInfo* module, Arena* arena);
+
+	private:
+		void readSymbols(PDBParser& parser, StreamReader& reader, uint32_t end);
 	};
 
 	// The name stream maps file indices with the path of the source file
 	void loadNameStream(NameStream& ns);
+	// Which arena readers should copy into, null if they aren't being used
+	Arena* arena(Arena& which) { return m_useArena ? &which : nullptr; }
+	// Function and global names go into the pool, copied only if the reader
+	// had to copy them to the heap, or they weren't terminated in size bytes
+	StringPool::String intern(const DataPtr<char>& str)
+	{
+		return m_strings.intern(str.data, strlen(str.data), str.isAllocated);
+	}
+	StringPool::String intern(const DataPtr<char>& str, size_t size)
+	{
+		size_t length = strnlen(str.data, size);
+		return m_strings.intern(str.data, length, str.isAllocated || length == size);
+	}
+	// The page runs of a stream as ranges of the file
+	std::vector<MMapWrapper::Range> getStreamRanges(int32_t index) const;
+	// Lets the OS and the prefetcher know the parser is moving on to a step of
+	// the access plan. Can be called from any thread.
+	void beginStep(size_t step);
+	// An arena for the task'th of the tasks modules are decoded on in parallel
+	Arena* taskArena(size_t task);
 	// The type stream maps a type id to a description of that type
-	TypeMap loadTypeStream();
+	void loadTypeStream(TypeTable& table);
+
+	// Decodes the records of types [first, last), the first of which is at
+	// offset, which is left just past the last one read. Returns the type it
+	// stopped at, which is before last if a record without a type was found,
+	// none of the types after it are used.
+	uint32_t readTypes(StreamReader& reader, uint32_t first, uint32_t last, uint32_t& offset, TypeTable& table);
+
+	// Decodes the block'th block of a lazily decoded table, which is only
+	// trusted if it ends where the next block starts
+	void decodeTypeBlock(TypeTable& table, size_t block, uint32_t start);
+	// Every type decoded in order, for when the offsets of blocks are wrong
+	const TypeTable& typeFallback(const TypeTable& table, uint32_t start);
+
+	// The type index offsets in the TPI hash stream, every one of which is
+	// the start of a chunk. Empty if there are none or they can't be trusted.
+	std::vector<TypeChunk> getTypeOffsets(const TypeInfoHeader& header, uint32_t start);
+	// Splits the types into at most count chunks of about the same size, using
+	// the type index offsets. Empty if there are none.
+	std::vector<TypeChunk> getTypeChunks(const TypeInfoHeader& header, uint32_t start, size_t count);
 
 	enum StringizeFlags
 	{
@@ -308,38 +1064,71 @@ private:
 		IsTopLevel = 0x2
 	};
 
-	static bool stringizeType(uint32_t type, std::string& output, const TypeMap& tm, uint32_t flags);
-
-	typedef std::function<void(StreamReader&, int32_t, uint32_t)> ModuleReadCB;
-	void readModule(const DBIModuleInfo* module, int32_t section, ModuleReadCB cb);
-
+	// Throws BudgetExceeded if nested more than depth deep. names can be null,
+	// and has to be when depth is limited, as a name found in it could be
+	// nested deeper than depth allows.
+	static bool stringizeType(uint32_t type, std::string& output, const TypeTable& tm, TypeNameCache* names,
+		uint32_t flags, uint32_t depth = ~0u);
+	// Stringizes a type that's in the table, the types it refers to included
+	static bool stringizeRecord(const TypeInfo& ti, std::string& output, const TypeTable& tm,
+		TypeNameCache* names, uint32_t flags, uint32_t depth);
+
+	// Throws BudgetExceeded once the budget is gone, for everything after that
+	// too so that every thread stops
+	void checkBudget();
+	void exceedBudget(const char* reason);
+	bool truncating() const { return m_budget.partial == ParseBudget::Truncate; }
+
+	std::string debugIdentifier(uint32_t age) const;
 	void printHeader(const DBIHeader* header, FILE* of, const char* platform = nullptr);
 	void readSectionHeaders(uint32_t headerStream, SectionHeaders& headers);
-	void getModuleFiles(const DBIModuleInfo* module, uint32_t& id, UniqueSrcFiles& unique, SrcFileIndex& fileIndex);
+	// Gives the module's files ids, which depend on the order modules are added in
+	void addModuleFiles(const ModuleDecoder& module, uint32_t& id, UniqueSrcFiles& unique, SrcFileIndex& fileIndex);
 	void printFiles(const SrcFileIndex& fileIndex, FILE* of);
-	void getModuleFunctions(const DBIModuleInfo* module, Functions& funcs);
 	void getGlobalFunctions(uint16_t symRecStream, const SectionHeaders& headers, Globals& globals);
-	void resolveFunctionLines(const DBIModuleInfo* module, Functions& funcs, const UniqueSrcFiles& unique, const SrcFileIndex& fileIndex);
-	void printFunctions(Functions& funcs, const TypeMap& tm, FILE* of);
+	// Only the lines of funcs[first, last) are resolved, so that ranges can be
+	// done in parallel. The lines of blocks that win are read into arena.
+	void resolveFunctionLines(ModuleDecoder& module, FunctionTable& funcs, size_t first, size_t last,
+		const UniqueSrcFiles& unique, const SrcFileIndex& fileIndex, Arena* arena);
+	// Formats the functions into chunks of text for out to write, the chunks
+	// are formatted in parallel
+	void printFunctions(FunctionTable& funcs, const TypeTable& tm, TypeNameCache* names, ChunkWriter& out);
+	// Appends the records of funcs[first, last) to out, str and temp are scratch space
+	void formatFunctions(const FunctionTable& funcs, size_t first, size_t last, const TypeTable& tm, TypeNameCache* names,
+		std::string& out, std::string& str, std::string& temp);
 	template<typename T>
 	void readFPO(uint32_t fpoStream, std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData);
 	template<typename T>
-	bool updateParamSize(FunctionRecord& func, std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData);
-	bool updateParamSize(FunctionRecord& func, Globals& globals);
-	void updateParamSize(FunctionRecord& func, const FPO_DATA& fpoData);
-	void updateParamSize(FunctionRecord& func, const FPO_DATA_V2& fpoData);
+	bool updateParamSize(FunctionTable& funcs, size_t f, std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData);
+	bool updateParamSize(FunctionTable& funcs, size_t f, Globals& globals);
+	void updateParamSize(FunctionTable& funcs, size_t f, const FPO_DATA& fpoData);
+	void updateParamSize(FunctionTable& funcs, size_t f, const FPO_DATA_V2& fpoData);
 	template<typename T>
-	void printFPOs(std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData, const NameStream& names, FILE* of);
-	void printFPO(const FPO_DATA& data, const NameStream& names, FILE* of);
-	void printFPO(const FPO_DATA_V2& data, const NameStream& names, FILE* of);
+	void printFPOs(std::map<std::pair<uint32_t, uint32_t>, DataPtr<T>>& fpoData, const NameStream& names, ChunkWriter& out);
+	void printFPO(const FPO_DATA& data, const NameStream& names, std::string& out);
+	void printFPO(const FPO_DATA_V2& data, const NameStream& names, std::string& out);
 
 	std::vector<StreamPair>			m_streams;
 	std::map<std::string, int32_t>	m_nameIndices;
 
+	typedef std::unordered_map<uint32_t, std::shared_ptr<std::vector<uint8_t>>> StreamCopies;
+	StreamCopies					m_streamCopies;		//!< Streams that had to be made contiguous, shared by all of their views
+	std::mutex						m_streamCopyLock;
+
 	GUID			m_guid;		//!< Unique GUID for the PDB, found in the NameIndexHeader in the root stream, matches the guid returned by IDiaSession::get_globalScope()->get_guid()
 
 	const uint8_t*	m_base;
 	MMapWrapper		m_mapping;
+	mutable PageCache	m_pageCache;
+	PipeReader		m_pipe;
+	size_t			m_pageCacheSize;
+	mutable WindowedMapping	m_windows;
+	size_t			m_windowBudget;
+	std::shared_ptr<Prefetcher>	m_prefetcher;	//!< Shared so that Prefetcher can stay incomplete here
+	std::mutex		m_stepLock;
+	size_t			m_prefetchDepth;
+	size_t			m_decodeTasks;
+	std::string		m_path;
 	std::string		m_filename;
 
 	bool m_foundPE;
@@ -349,6 +1138,26 @@ private:
 	uint32_t	m_pageSize;
 	uint32_t	m_numPages;
 	bool		m_isExe;
+	bool		m_useAccessPlan;
+	bool		m_useArena;
+	bool		m_lazyTypes;
+	TypeStats	m_typeStats;
+
+	std::mutex					m_typeFallbackLock;
+	std::unique_ptr<TypeTable>	m_typeFallback;
+
+	ParseBudget							m_budget;
+	std::chrono::steady_clock::time_point	m_deadline;
+	std::atomic<uint64_t>				m_bytesAllocated;	//!< By the arenas and stream copies
+	std::atomic<const char*>			m_budgetReason;
+
+	// Live until the next printBreakpadSymbols or close. Every task modules
+	// are decoded on gets an arena of its own, and the scratch arena is reset
+	// after every module.
+	Arena		m_arena;
+	Arena		m_scratchArena;
+	std::vector<std::unique_ptr<Arena>>	m_taskArenas;
+	StringPool	m_strings;
 }; // PDBParser
 
 } // google_breakpad
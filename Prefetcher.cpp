@@ -0,0 +1,529 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#include "Prefetcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The kernel headers are all that's needed, the ring is driven with raw
+// syscalls so there is no dependency on liburing
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+namespace google_breakpad
+{
+
+namespace
+{
+	// Reads are split up so no one of them holds up the queue for too long
+	const uint32_t kChunkSize = 256 * 1024;
+	const unsigned kRingEntries = 64;
+	const size_t kMaxThreads = 4;
+}
+
+#ifdef HAVE_IO_URING
+struct Prefetcher::Ring
+{
+	int						fd;
+	unsigned				entries;
+	unsigned				inFlight;
+
+	void*					sqMap;
+	size_t					sqMapSize;
+	void*					cqMap;
+	size_t					cqMapSize;
+	io_uring_sqe*			sqes;
+	size_t					sqesSize;
+
+	unsigned*				sqHead;
+	unsigned*				sqTail;
+	unsigned*				sqMask;
+	unsigned*				sqArray;
+	unsigned*				cqHead;
+	unsigned*				cqTail;
+	unsigned*				cqMask;
+	io_uring_cqe*			cqes;
+
+	std::vector<iovec>		iovs;		//!< One for every read that can be in flight
+	std::vector<uint32_t>	freeSlots;
+	std::vector<uint8_t>	scratch;	//!< What was read is never looked at, so every read shares this
+
+	Ring()
+		: fd(-1)
+		, entries(0)
+		, inFlight(0)
+		, sqMap(MAP_FAILED)
+		, sqMapSize(0)
+		, cqMap(MAP_FAILED)
+		, cqMapSize(0)
+		, sqes((io_uring_sqe*)MAP_FAILED)
+		, sqesSize(0)
+	{}
+
+	~Ring()
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqesSize);
+		if (cqMap != MAP_FAILED)
+			munmap(cqMap, cqMapSize);
+		if (sqMap != MAP_FAILED)
+			munmap(sqMap, sqMapSize);
+		if (fd != -1)
+			close(fd);
+	}
+
+	static int enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+	{
+		int ret;
+		do
+		{
+			ret = (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+		} while (ret < 0 && errno == EINTR);
+		return ret;
+	}
+
+	bool init(unsigned count)
+	{
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+
+		fd = (int)syscall(__NR_io_uring_setup, count, &params);
+		if (fd < 0)
+			return false;
+
+		sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+		sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqMap == MAP_FAILED || cqMap == MAP_FAILED || sqes == MAP_FAILED)
+			return false;
+
+		uint8_t* sq = (uint8_t*)sqMap;
+		sqHead = (unsigned*)(sq + params.sq_off.head);
+		sqTail = (unsigned*)(sq + params.sq_off.tail);
+		sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+		sqArray = (unsigned*)(sq + params.sq_off.array);
+
+		uint8_t* cq = (uint8_t*)cqMap;
+		cqHead = (unsigned*)(cq + params.cq_off.head);
+		cqTail = (unsigned*)(cq + params.cq_off.tail);
+		cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		// The completion queue is at least as big as the submission queue, so
+		// capping what is in flight to the latter means it can never overflow
+		entries = params.sq_entries;
+		iovs.resize(entries);
+		for (unsigned i = 0; i < entries; ++i)
+			freeSlots.push_back(i);
+
+		scratch.resize(kChunkSize);
+		return true;
+	}
+
+	// Hands a read to the kernel, false if there is no room for it
+	bool push(int file, const Read& read)
+	{
+		if (freeSlots.empty())
+			return false;
+
+		uint32_t slot = freeSlots.back();
+		freeSlots.pop_back();
+
+		iovs[slot].iov_base = scratch.data();
+		iovs[slot].iov_len = read.size;
+
+		unsigned tail = *sqTail;
+		unsigned index = tail & *sqMask;
+
+		io_uring_sqe& sqe = sqes[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READV;
+		sqe.fd = file;
+		sqe.addr = (uint64_t)(uintptr_t)&iovs[slot];
+		sqe.len = 1;
+		sqe.off = read.offset;
+		sqe.user_data = ((uint64_t)read.step << 32) | slot;
+
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+		// Anything a failed enter left behind gets submitted along with this
+		unsigned toSubmit = tail + 1 - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		if (enter(fd, toSubmit, 0, 0) < 0 && errno != EAGAIN && errno != EBUSY)
+		{
+			// Take it back out, nothing else is going to get it submitted
+			__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+			freeSlots.push_back(slot);
+			return false;
+		}
+
+		++inFlight;
+		return true;
+	}
+
+	// Calls done(step, result) for every finished read, waiting for at least
+	// one to finish first if asked to. False if the kernel can't be waited on.
+	template<typename F>
+	bool reap(bool wait, F done)
+	{
+		if (wait && inFlight > 0)
+		{
+			unsigned unsubmitted = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+			if (enter(fd, unsubmitted, 1, IORING_ENTER_GETEVENTS) < 0)
+				return false;
+		}
+
+		unsigned head = *cqHead;
+		unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+		for (; head != tail; ++head)
+		{
+			const io_uring_cqe& cqe = cqes[head & *cqMask];
+			freeSlots.push_back((uint32_t)cqe.user_data);
+			--inFlight;
+			done((uint32_t)(cqe.user_data >> 32), cqe.res);
+		}
+
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		return true;
+	}
+};
+#else
+struct Prefetcher::Ring {};
+#endif
+
+Prefetcher::Prefetcher()
+	:
+#ifdef _WIN32
+	m_file(INVALID_HANDLE_VALUE),
+#else
+	m_fd(-1),
+#endif
+	m_depth(0)
+	, m_submitted(0)
+	, m_wanted(0)
+	, m_ringFailed(false)
+	, m_stop(false)
+	, m_usingIoUring(false)
+	, m_bytesRead(0)
+	, m_waitSeconds(0)
+{}
+
+Prefetcher::~Prefetcher()
+{
+	Stop();
+}
+
+bool Prefetcher::Start(const char* filename, Plan plan, size_t depth, bool allowIoUring)
+{
+	Stop();
+
+#ifdef _WIN32
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+#else
+	m_fd = open(filename, O_RDONLY, 0);
+	if (m_fd == -1)
+		return false;
+#endif
+
+	m_plan = std::move(plan);
+	m_depth = depth;
+	m_submitted = 0;
+	m_wanted = 0;
+	m_pending.assign(m_plan.size(), 0);
+	m_bytesRead = 0;
+	m_waitSeconds = 0;
+
+#ifdef HAVE_IO_URING
+	if (allowIoUring)
+	{
+		m_ring.reset(new Ring);
+		if (!m_ring->init(kRingEntries))
+			m_ring.reset();
+	}
+#else
+	(void)allowIoUring;
+#endif
+
+	m_usingIoUring = m_ring != nullptr;
+	m_ringFailed = false;
+	m_stop = false;
+	if (m_ring)
+		m_driver = std::thread([this] { driver(); });
+	else
+	{
+		size_t count = std::max<size_t>(std::min(depth, kMaxThreads), 1);
+		for (size_t i = 0; i < count; ++i)
+			m_threads.push_back(std::thread([this] { worker(); }));
+	}
+
+	return true;
+}
+
+void Prefetcher::Stop()
+{
+	if (m_driver.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+		}
+		m_work.notify_all();
+		m_driver.join();
+	}
+
+#ifdef HAVE_IO_URING
+	if (m_ring)
+	{
+		// The kernel may still be writing to the scratch buffer
+		while (m_ring->inFlight > 0 && m_ring->reap(true, [this](uint32_t step, int64_t result) { complete(step, result); }))
+			;
+		m_ring.reset();
+	}
+#endif
+
+	if (!m_threads.empty())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+			m_queue.clear();
+		}
+		m_work.notify_all();
+
+		for (auto& thread : m_threads)
+			thread.join();
+		m_threads.clear();
+	}
+
+#ifdef _WIN32
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_fd != -1)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+#endif
+
+	m_plan.clear();
+	m_pending.clear();
+}
+
+void Prefetcher::BeginStep(size_t step)
+{
+	if (step >= m_plan.size())
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+	size_t end = std::min(step + 1 + m_depth, m_plan.size());
+
+	// The lock is only held to hand over reads, never while they are waited
+	// on, so threads beginning different steps don't hold each other up
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_submitted = std::max(m_submitted, step);
+	if (m_ring)
+		m_wanted = std::max(m_wanted, end);
+	else
+	{
+		for (; m_submitted < end; ++m_submitted)
+			enqueue(m_submitted);
+	}
+	m_work.notify_all();
+
+	m_done.wait(lock, [this, step] { return m_submitted > step && m_pending[step] == 0; });
+	m_waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Prefetcher::enqueue(size_t step)
+{
+	for (auto& range : m_plan[step])
+	{
+		for (uint64_t offset = 0; offset < range.size; offset += kChunkSize)
+		{
+			Read read = { range.offset + offset, (uint32_t)std::min<uint64_t>(kChunkSize, range.size - offset), (uint32_t)step };
+			m_queue.push_back(read);
+			++m_pending[step];
+		}
+	}
+}
+
+void Prefetcher::push(size_t step)
+{
+#ifdef HAVE_IO_URING
+	auto onComplete = [this](uint32_t s, int64_t result) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		complete(s, result);
+	};
+
+	for (auto& range : m_plan[step])
+	{
+		for (uint64_t offset = 0; offset < range.size && !m_ringFailed; offset += kChunkSize)
+		{
+			Read read = { range.offset + offset, (uint32_t)std::min<uint64_t>(kChunkSize, range.size - offset), (uint32_t)step };
+
+			// Counted first, so that it can't be completed before it is
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				++m_pending[step];
+			}
+
+			// Make room by waiting on earlier reads if the ring is full
+			bool pushed;
+			while (!(pushed = m_ring->push(m_fd, read)) && m_ring->inFlight > 0)
+			{
+				if (!m_ring->reap(true, onComplete))
+				{
+					m_ringFailed = true;
+					break;
+				}
+			}
+
+			// A read that can't be submitted is just not prefetched
+			if (!pushed)
+				onComplete(read.step, -1);
+		}
+	}
+	m_done.notify_all();
+#else
+	(void)step;
+#endif
+}
+
+void Prefetcher::driver()
+{
+#ifdef HAVE_IO_URING
+	auto onComplete = [this](uint32_t s, int64_t result) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		complete(s, result);
+	};
+
+	while (true)
+	{
+		size_t step;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_work.wait(lock, [this] { return m_stop || m_submitted < m_wanted || (!m_ringFailed && m_ring->inFlight > 0); });
+			if (m_stop)
+				return;
+			step = m_submitted < m_wanted ? m_submitted : m_plan.size();
+		}
+
+		if (step < m_plan.size())
+		{
+			push(step);
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_submitted = std::max(m_submitted, step + 1);
+		}
+		else if (!m_ring->reap(true, onComplete))
+			m_ringFailed = true;
+
+		if (m_ringFailed)
+		{
+			// Nothing more will ever complete, so nobody is left waiting on it
+			std::lock_guard<std::mutex> lock(m_lock);
+			std::fill(m_pending.begin(), m_pending.end(), 0);
+		}
+		m_done.notify_all();
+	}
+#endif
+}
+
+void Prefetcher::complete(uint32_t step, int64_t result)
+{
+	if (result > 0)
+		m_bytesRead += result;
+
+	// Prefetching is only ever a hint, so a failed read is done with all the same
+	if (step < m_pending.size() && m_pending[step] > 0)
+		--m_pending[step];
+}
+
+void Prefetcher::worker()
+{
+	std::vector<uint8_t> buffer(kChunkSize);
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	while (true)
+	{
+		m_work.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (m_stop)
+			return;
+
+		Read read = m_queue.front();
+		m_queue.pop_front();
+
+		lock.unlock();
+		bool ok = readFile(read.offset, buffer.data(), read.size);
+		lock.lock();
+
+		complete(read.step, ok ? read.size : -1);
+		m_done.notify_all();
+	}
+}
+
+bool Prefetcher::readFile(uint64_t offset, uint8_t* out, uint32_t size)
+{
+#ifdef _WIN32
+	OVERLAPPED ov = {};
+	ov.Offset = (DWORD)offset;
+	ov.OffsetHigh = (DWORD)(offset >> 32);
+
+	DWORD numRead = 0;
+	return ReadFile(m_file, out, size, &numRead, &ov) && numRead > 0;
+#else
+	ssize_t numRead;
+	do
+	{
+		numRead = pread(m_fd, out, size, (off_t)offset);
+	} while (numRead < 0 && errno == EINTR);
+	return numRead > 0;
+#endif
+}
+
+} // google_breakpad
@@ -0,0 +1,110 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#pragma once
+
+#include "PDBParser.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace google_breakpad
+{
+
+// Reads the streams of the steps the parser is about to get to in the
+// background, so that they are already in the OS file cache by the time it
+// does, instead of every page fault or cache miss stalling the parse. Uses
+// io_uring where the kernel has it, otherwise a few threads doing plain reads.
+// Steps can be begun from any number of threads at once, each only waits on
+// its own step's reads.
+class Prefetcher
+{
+public:
+	typedef MMapWrapper::AccessPlan Plan;
+
+	Prefetcher();
+	~Prefetcher();
+
+	// depth is how many steps past the current one to keep reads in flight for.
+	// Threads are used instead of io_uring if it isn't allowed or available.
+	bool Start(const char* filename, Plan plan, size_t depth, bool allowIoUring = true);
+	void Stop();
+
+	// The parser is about to read the step's streams. Submits reads for the
+	// steps coming up after it, then waits for the step's own to complete.
+	void BeginStep(size_t step);
+
+	// These all still hold once stopped
+	bool UsingIoUring() const { return m_usingIoUring; }
+	uint64_t BytesRead() const { return m_bytesRead; }
+	// Time spent in BeginStep waiting for reads that hadn't finished yet
+	double WaitSeconds() const { return m_waitSeconds; }
+
+private:
+	struct Ring;
+
+	struct Read
+	{
+		uint64_t	offset;
+		uint32_t	size;
+		uint32_t	step;
+	};
+
+	void enqueue(size_t step);
+	void push(size_t step);
+	void complete(uint32_t step, int64_t result);
+	void driver();
+	void worker();
+	bool readFile(uint64_t offset, uint8_t* out, uint32_t size);
+
+#ifdef _WIN32
+	HANDLE						m_file;
+#else
+	int							m_fd;
+#endif
+	Plan						m_plan;
+	size_t						m_depth;
+	size_t						m_submitted;	//!< Steps before this have had their reads submitted
+	size_t						m_wanted;		//!< Steps before this are to be submitted by the ring's driver
+	std::vector<uint32_t>		m_pending;		//!< Reads still outstanding for every step
+
+	std::unique_ptr<Ring>		m_ring;			//!< Only ever touched by m_driver
+	std::thread					m_driver;
+	bool						m_ringFailed;	//!< The kernel couldn't be waited on, so nothing more is read
+
+	std::mutex					m_lock;
+	std::condition_variable		m_work;
+	std::condition_variable		m_done;
+	std::deque<Read>			m_queue;
+	std::vector<std::thread>	m_threads;
+	bool						m_stop;
+
+	bool						m_usingIoUring;
+
+	std::atomic<uint64_t>		m_bytesRead;
+	double						m_waitSeconds;
+};
+
+} // google_breakpad
@@ -0,0 +1,163 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#include "StreamReader.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets any intrinsic be used anywhere, it's up to us to check the CPU first
+#define TARGET(isa)
+#else
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace google_breakpad
+{
+
+namespace
+{
+
+const uint8_t* findNulScalar(const uint8_t* begin, const uint8_t* end)
+{
+	while (begin != end && *begin != 0)
+		++begin;
+	return begin;
+}
+
+#ifdef HAVE_X86_SIMD
+
+inline unsigned trailingZeros(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned)index;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// Only whole vectors that lie inside the run are loaded, so nothing past its
+// end is ever touched, the last few bytes are left to the scalar loop
+
+TARGET("sse2")
+const uint8_t* findNulSSE2(const uint8_t* begin, const uint8_t* end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (; end - begin >= 16; begin += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*)begin);
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+		if (mask)
+			return begin + trailingZeros(mask);
+	}
+	return findNulScalar(begin, end);
+}
+
+TARGET("avx2")
+const uint8_t* findNulAVX2(const uint8_t* begin, const uint8_t* end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (; end - begin >= 32; begin += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)begin);
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+		if (mask)
+			return begin + trailingZeros(mask);
+	}
+	return findNulSSE2(begin, end);
+}
+
+bool cpuHas(NulScan scan)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	if (scan == NulScan::SSE2)
+		return (info[3] & (1 << 26)) != 0;
+
+	// AVX2 also needs the OS to save the ymm registers
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return scan == NulScan::SSE2 ? __builtin_cpu_supports("sse2") : __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // HAVE_X86_SIMD
+
+NulScanFn scanner(NulScan scan)
+{
+	switch (scan)
+	{
+	case NulScan::Scalar:
+		return findNulScalar;
+#ifdef HAVE_X86_SIMD
+	case NulScan::SSE2:
+		return cpuHas(NulScan::SSE2) ? findNulSSE2 : nullptr;
+	case NulScan::AVX2:
+		return cpuHas(NulScan::AVX2) ? findNulAVX2 : nullptr;
+#endif
+	case NulScan::Best:
+		if (auto fn = scanner(NulScan::AVX2))
+			return fn;
+		if (auto fn = scanner(NulScan::SSE2))
+			return fn;
+		return findNulScalar;
+	default:
+		return nullptr;
+	}
+}
+
+std::atomic<NulScanFn> s_findNul(scanner(NulScan::Best));
+
+} // namespace
+
+const uint8_t*
+findNul(const uint8_t* begin, const uint8_t* end)
+{
+	return s_findNul.load(std::memory_order_relaxed)(begin, end);
+}
+
+bool
+setNulScan(NulScan scan)
+{
+	NulScanFn fn = scanner(scan);
+	if (!fn)
+		return false;
+
+	s_findNul.store(fn, std::memory_order_relaxed);
+	return true;
+}
+
+} // google_breakpad
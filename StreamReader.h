@@ -0,0 +1,300 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2013 Jake Shadle
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: Jake Shadle <jake.shadle@frostbite.com>
+
+#pragma once
+
+#include "PDBParser.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace google_breakpad
+{
+
+// Finds the first NUL in [begin, end), or returns end if there isn't one. Uses
+// the widest vector instructions the CPU has unless told otherwise.
+const uint8_t* findNul(const uint8_t* begin, const uint8_t* end);
+
+typedef const uint8_t* (*NulScanFn)(const uint8_t* begin, const uint8_t* end);
+
+enum class NulScan
+{
+	Scalar,
+	SSE2,
+	AVX2,
+	Best
+};
+
+// Picks the implementation findNul uses, for benchmarking. Returns false if
+// the CPU or the build doesn't support it.
+bool setNulScan(NulScan scan);
+
+class StreamReader
+{
+public:
+	StreamReader(const PDBParser::StreamPair& stream, const PDBParser& parser, uint32_t offset = 0, Arena* arena = nullptr)
+		: m_stream(&stream)
+		, m_parser(&parser)
+		, m_arena(arena)
+		, m_data(nullptr)
+		, m_seqPageEnd(nullptr)
+		, m_runData(nullptr)
+		, m_offset(0xffffffff)
+		, m_runOffset(0)
+		, m_runSize(0)
+		, m_end((uint32_t)std::min<uint64_t>((uint64_t)stream.pageIndices.size() * parser.pageSize(), 0xffffffff))
+	{
+		seek(offset);
+	}
+
+	// Reads from a contiguous view, so nothing is ever split. Anything read is
+	// only valid for as long as the view's memory is.
+	StreamReader(const StreamView& view, uint32_t offset = 0)
+		: m_stream(nullptr)
+		, m_parser(nullptr)
+		, m_arena(nullptr)
+		, m_data(nullptr)
+		, m_seqPageEnd(view.data() + view.size())
+		, m_runData(view.data())
+		, m_offset(0xffffffff)
+		, m_runOffset(0)
+		, m_runSize(view.size())
+		, m_end(view.size())
+		, m_view(view)
+	{
+		seek(offset);
+	}
+
+	// Where records that have to be copied out go from now on, the heap if null
+	void setArena(Arena* arena) { m_arena = arena; }
+
+	uint32_t getOffset() const { return m_offset; }
+	const uint8_t* getData() const { return m_data; };
+
+	bool isValidOffset(uint32_t offset)
+	{
+		// The end of a view is valid, a paged stream has to have a page for it
+		return m_stream ? offset < m_end : offset <= m_end;
+	}
+
+	// Whether all size bytes from offset could be read, without reading them
+	bool isValidRange(uint32_t offset, uint32_t size) const
+	{
+		return offset <= m_end && size <= m_end - offset;
+	}
+
+	void align(uint32_t align)
+	{
+		uint32_t diff = m_offset % align;
+
+		if (diff)
+			seek(m_offset + align - diff);
+	}
+
+	void seek(uint32_t offset)
+	{
+		// Most seeks stay inside the run of adjacent pages we are already on
+		if (offset - m_runOffset < m_runSize)
+		{
+			m_data = m_runData + (offset - m_runOffset);
+			m_offset = offset;
+			return;
+		}
+
+		if (!m_stream)
+		{
+			if (offset != m_end)
+				throw std::runtime_error("Requesting offset outside of stream view");
+
+			m_data = m_seqPageEnd;
+			m_offset = offset;
+			return;
+		}
+
+		uint32_t index = offset / m_parser->pageSize();
+		if (index >= m_stream->pageRuns.size())
+			throw std::runtime_error("Requesting offset outside of page range");
+
+		const PDBParser::PageRun* run = &m_stream->runs[m_stream->pageRuns[index]];
+		uint32_t pageSize = m_parser->pageSize();
+
+		// When the file is mapped the whole run is available, otherwise start
+		// from the page we want and take whatever is contiguous after it
+		uint32_t first = m_parser->data() ? run->offset : index * pageSize;
+		uint32_t count = (run->offset + run->size - first) / pageSize;
+
+		m_runData = m_parser->getPages(run->page + (first - run->offset) / pageSize, count, m_pin);
+		m_runOffset = first;
+		m_runSize = count * pageSize;
+		m_seqPageEnd = m_runData + m_runSize;
+		m_data = m_runData + (offset - first);
+		m_offset = offset;
+
+		assert(m_seqPageEnd > m_data);
+	}
+
+	template<typename T>
+	T peek()
+	{
+		// Verify!
+		if (m_data + sizeof(T) > m_seqPageEnd)
+		{
+			uint32_t offset = m_offset;
+
+			T retValue;
+			uint8_t* outVal = (uint8_t*)&retValue;
+			uint32_t toRead = sizeof(T);
+
+			copyOut(outVal, toRead);
+
+			// Return back to the original position
+			seek(offset);
+
+			return retValue;
+		}
+		else
+			return *((const T*)m_data);
+	}
+
+	template<typename T>
+	DataPtr<T> read(uint32_t size = 0)
+	{
+		uint32_t toRead = size == 0 ? sizeof(T) : size;
+
+		// Check to see if the data is split across multiple pages, or if the
+		// page it is on can go away once we move off of it
+		if (m_data + toRead > m_seqPageEnd || m_pin)
+		{
+			uint8_t* alloced = (uint8_t*)(m_arena ? m_arena->allocate(toRead) : malloc(toRead));
+			try
+			{
+				copyOut(alloced, toRead);
+			}
+			catch (...)
+			{
+				// A run that's cut short, the arena gets it back when it's reset
+				if (!m_arena)
+					free(alloced);
+				throw;
+			}
+
+			return DataPtr<T>(alloced, m_arena == nullptr);
+		}
+		else
+		{
+			DataPtr<T> read(m_data);
+
+			m_data += toRead;
+			m_offset += toRead;
+
+			return read;
+		}
+	}
+
+	DataPtr<char> readString()
+	{
+		const uint8_t* nul = findNul(m_data, m_seqPageEnd);
+		if (nul != m_seqPageEnd)
+			return read<char>((uint32_t)(nul - m_data) + 1);
+
+		// The string carries on into the next run, or further
+		uint32_t origOffset = m_offset;
+		uint32_t strLen = (uint32_t)(m_seqPageEnd - m_data);
+
+		do
+		{
+			seek(origOffset + strLen);
+			if (m_data == m_seqPageEnd)
+				throw std::runtime_error("Unterminated string at the end of the stream");
+
+			nul = findNul(m_data, m_seqPageEnd);
+			strLen += (uint32_t)(nul - m_data);
+		} while (nul == m_seqPageEnd);
+
+		seek(origOffset);
+		return read<char>(strLen + 1);
+	}
+
+	// Moves past a string like readString, but without copying it out
+	void skipString()
+	{
+		const uint8_t* nul = findNul(m_data, m_seqPageEnd);
+		while (nul == m_seqPageEnd)
+		{
+			// The string carries on into the next run, or further
+			seek(m_offset + (uint32_t)(m_seqPageEnd - m_data));
+			if (m_data == m_seqPageEnd)
+				throw std::runtime_error("Unterminated string at the end of the stream");
+
+			nul = findNul(m_data, m_seqPageEnd);
+		}
+
+		m_offset += (uint32_t)(nul + 1 - m_data);
+		m_data = nul + 1;
+	}
+
+private:
+
+	// Copies data out run by run, leaving us just past the end of it
+	void copyOut(uint8_t* out, uint32_t toRead)
+	{
+		while (true)
+		{
+			uint32_t seqRead = std::min((uint32_t)(m_seqPageEnd - m_data), toRead);
+			if (seqRead == 0 && m_offset >= m_end)
+				throw std::runtime_error("Reading past the end of the stream");
+
+			memcpy(out, m_data, seqRead);
+			toRead -= seqRead;
+			out += seqRead;
+
+			if (toRead == 0)
+			{
+				m_data += seqRead;
+				m_offset += seqRead;
+				return;
+			}
+
+			// When we are sitting on the end of a run this moves us on to the next one
+			seek(m_offset + seqRead);
+		}
+	}
+
+	const PDBParser::StreamPair*	m_stream;		//!< Null when reading from a view
+	const PDBParser*				m_parser;
+	Arena*							m_arena;
+
+	const uint8_t*					m_data;
+	const uint8_t*					m_seqPageEnd;
+	const uint8_t*					m_runData;		//!< Start of the run we are currently on
+	uint32_t						m_offset;
+	uint32_t						m_runOffset;	//!< Logical stream offset of m_runData
+	uint32_t						m_runSize;
+	uint32_t						m_end;			//!< Offset one past the last readable byte
+	StreamView						m_view;
+	std::shared_ptr<const void>		m_pin;			//!< Keeps a cached page alive while we are on it
+};
+
+} // google_breakpad
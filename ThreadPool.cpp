@@ -0,0 +1,272 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#include "ThreadPool.h"
+
+namespace google_breakpad
+{
+
+namespace
+{
+
+size_t s_defaultThreads = 0;
+
+// The pool and worker the current thread belongs to, if any
+thread_local ThreadPool* t_pool = nullptr;
+thread_local size_t t_worker = 0;
+// The group of the task the current thread is running
+thread_local const TaskGroup* t_group = nullptr;
+
+// Takes the task at the back of tasks, or the front, that belongs to group
+// if there is one
+template<typename Queue>
+bool takeFrom(Queue& tasks, bool newest, const TaskGroup* group, typename Queue::value_type& task)
+{
+	if (tasks.empty())
+		return false;
+
+	if (!group)
+	{
+		task = std::move(newest ? tasks.back() : tasks.front());
+		if (newest)
+			tasks.pop_back();
+		else
+			tasks.pop_front();
+		return true;
+	}
+
+	for (size_t i = 0; i < tasks.size(); ++i)
+	{
+		auto it = newest ? tasks.end() - 1 - i : tasks.begin() + i;
+		if (it->group && it->group->Within(group))
+		{
+			task = std::move(*it);
+			tasks.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t workers)
+	: m_pending(0)
+	, m_stop(false)
+	, m_steals(0)
+{
+	for (size_t i = 0; i < workers; ++i)
+		m_workers.emplace_back(new Worker);
+
+	// Only start them once every deque exists, so they can all be stolen from
+	for (size_t i = 0; i < workers; ++i)
+		m_workers[i]->thread = std::thread(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for (auto& worker : m_workers)
+		worker->thread.join();
+}
+
+ThreadPool&
+ThreadPool::Default()
+{
+	static ThreadPool pool([]() {
+		size_t threads = s_defaultThreads ? s_defaultThreads : std::thread::hardware_concurrency();
+		// The thread waiting on the tasks helps run them
+		return threads > 1 ? threads - 1 : 0;
+	}());
+	return pool;
+}
+
+void
+ThreadPool::SetDefaultThreads(size_t threads)
+{
+	s_defaultThreads = threads;
+}
+
+const TaskGroup*
+ThreadPool::CurrentGroup()
+{
+	return t_group;
+}
+
+void
+ThreadPool::Submit(Task task, const TaskGroup* group)
+{
+	// Counted before it can be found, so that m_pending never drops below the
+	// tasks that are actually queued
+	++m_pending;
+
+	if (t_pool == this)
+	{
+		Worker& worker = *m_workers[t_worker];
+		std::lock_guard<std::mutex> guard(worker.lock);
+		worker.tasks.push_back(Queued{ std::move(task), group });
+	}
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (t_pool != this)
+		m_submitted.push_back(Queued{ std::move(task), group });
+	m_wake.notify_one();
+}
+
+bool
+ThreadPool::RunPending(const TaskGroup* group)
+{
+	Queued task;
+	if (!take(t_pool == this ? t_worker : m_workers.size(), group, task))
+		return false;
+
+	run(task);
+	return true;
+}
+
+bool
+ThreadPool::take(size_t self, const TaskGroup* group, Queued& task)
+{
+	if (m_pending == 0)
+		return false;
+
+	// Our own newest task first, its data is most likely still in the cache
+	if (self < m_workers.size())
+	{
+		Worker& worker = *m_workers[self];
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if (takeFrom(worker.tasks, true, group, task))
+		{
+			--m_pending;
+			return true;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		if (takeFrom(m_submitted, false, group, task))
+		{
+			--m_pending;
+			return true;
+		}
+	}
+
+	// Then the oldest task of someone else, which tends to be the biggest
+	for (size_t i = 1; i <= m_workers.size(); ++i)
+	{
+		size_t victim = (self + i) % m_workers.size();
+		if (victim == self)
+			continue;
+
+		Worker& worker = *m_workers[victim];
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if (takeFrom(worker.tasks, false, group, task))
+		{
+			--m_pending;
+			++m_steals;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void
+ThreadPool::run(Queued& task)
+{
+	const TaskGroup* outer = t_group;
+	t_group = task.group;
+	task.task();
+	task.task = nullptr;
+	t_group = outer;
+}
+
+void
+ThreadPool::work(size_t self)
+{
+	t_pool = this;
+	t_worker = self;
+
+	Queued task;
+	while (true)
+	{
+		if (take(self, nullptr, task))
+		{
+			run(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_wake.wait(lock, [this]() { return m_stop || m_pending != 0; });
+		if (m_stop)
+			return;
+	}
+}
+
+void
+TaskGroup::wait()
+{
+	while (true)
+	{
+		uint64_t submitted;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			if (m_outstanding == 0)
+				break;
+			submitted = m_submitted;
+		}
+
+		// Help out with our own tasks rather than sit idle, and only sleep once
+		// none are left that haven't been started. Any that are added after
+		// that wake us up again, as does the last one finishing.
+		if (!m_pool.RunPending(this))
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_done.wait(lock, [this, submitted]() { return m_outstanding == 0 || m_submitted != submitted; });
+		}
+	}
+
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		std::swap(error, m_error);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void
+TaskGroup::finish()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (--m_outstanding == 0)
+		m_done.notify_all();
+}
+
+} // google_breakpad
@@ -0,0 +1,294 @@
+/* -*- Mode: C++; ; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace google_breakpad
+{
+
+class TaskGroup;
+
+// A fixed set of worker threads, each with a deque of its own. Tasks a worker
+// submits go on its own deque and it works through them newest first, while
+// idle workers steal the oldest tasks of busy ones. Tasks submitted from any
+// other thread go on a shared queue.
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit ThreadPool(size_t workers);
+	~ThreadPool();
+
+	// The pool TaskGroups use unless given another one
+	static ThreadPool& Default();
+	// How many threads, counting the one that waits on the work, the default
+	// pool uses. 0, the default, is one per hardware thread and 1 runs every
+	// task as soon as it is submitted. Has no effect once the pool exists.
+	static void SetDefaultThreads(size_t threads);
+
+	size_t Workers() const { return m_workers.size(); }
+
+	// group is what the task belongs to, if anything
+	void Submit(Task task, const TaskGroup* group = nullptr);
+
+	// Runs a task of group, or of a group nested in it, that hasn't been
+	// started yet on the calling thread, if there is one, so that threads
+	// waiting on a group can help with it. Nothing else is run, so that a
+	// wait can't end up stuck behind unrelated work.
+	bool RunPending(const TaskGroup* group);
+
+	// The group of the task the calling thread is running, if any
+	static const TaskGroup* CurrentGroup();
+
+	// How many tasks were taken from another worker's deque
+	uint64_t Steals() const { return m_steals; }
+
+private:
+	struct Queued
+	{
+		Task				task;
+		const TaskGroup*	group;
+	};
+
+	struct Worker
+	{
+		std::mutex			lock;
+		std::deque<Queued>	tasks;
+		std::thread			thread;
+	};
+
+	bool take(size_t self, const TaskGroup* group, Queued& task);
+	static void run(Queued& task);
+	void work(size_t self);
+
+	std::vector<std::unique_ptr<Worker>>	m_workers;
+
+	std::mutex					m_lock;
+	std::condition_variable		m_wake;
+	std::deque<Queued>			m_submitted;	//!< Tasks from threads outside the pool
+	std::atomic<size_t>			m_pending;		//!< Tasks queued anywhere that haven't been taken
+	bool						m_stop;
+
+	std::atomic<uint64_t>		m_steals;
+};
+
+// Runs tasks on a pool and waits for them. An exception thrown by a task is
+// rethrown by wait, and the group waits for its tasks when destroyed, so
+// anything they use has to be declared before the group. A group made by a
+// task is nested in that task's group, and only ever outlived by it.
+class TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool& pool = ThreadPool::Default())
+		: m_pool(pool)
+		, m_parent(ThreadPool::CurrentGroup())
+		, m_outstanding(0)
+		, m_submitted(0)
+	{}
+
+	~TaskGroup()
+	{
+		try
+		{
+			wait();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	template<typename F>
+	void run(F&& func)
+	{
+		if (m_pool.Workers() == 0)
+		{
+			invoke(func);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			++m_outstanding;
+		}
+
+		auto task = std::make_shared<std::function<void()>>(std::forward<F>(func));
+		m_pool.Submit([this, task]() {
+			invoke(*task);
+			// Nothing of the task may outlive the group, which can go as soon as it is done
+			*task = nullptr;
+			finish();
+		}, this);
+
+		// A task can add to its own group, which a wait that ran out of
+		// tasks to help with has to hear about
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			++m_submitted;
+		}
+		m_done.notify_all();
+	}
+
+	void wait();
+
+	// Whether this is group or nested in it
+	bool Within(const TaskGroup* group) const
+	{
+		for (const TaskGroup* g = this; g; g = g->m_parent)
+		{
+			if (g == group)
+				return true;
+		}
+		return false;
+	}
+
+private:
+	TaskGroup(const TaskGroup&);
+	TaskGroup& operator=(const TaskGroup&);
+
+	template<typename F>
+	void invoke(F& func)
+	{
+		try
+		{
+			func();
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			if (!m_error)
+				m_error = std::current_exception();
+		}
+	}
+
+	void finish();
+
+	ThreadPool&				m_pool;
+	const TaskGroup*		m_parent;
+	std::mutex				m_lock;
+	std::condition_variable	m_done;
+	size_t					m_outstanding;
+	uint64_t				m_submitted;	//!< Tasks run has submitted, for waits to notice new ones
+	std::exception_ptr		m_error;
+};
+
+// Calls func(i) for every i in [first, last), in chunks of at least grain
+template<typename F>
+void parallelFor(size_t first, size_t last, const F& func, size_t grain = 1, ThreadPool& pool = ThreadPool::Default())
+{
+	if (first >= last)
+		return;
+
+	size_t count = last - first;
+	size_t chunks = std::min(std::max<size_t>(count / std::max<size_t>(grain, 1), 1), (pool.Workers() + 1) * 4);
+	if (chunks == 1)
+	{
+		for (size_t i = first; i < last; ++i)
+			func(i);
+		return;
+	}
+
+	TaskGroup tg(pool);
+	for (size_t c = 0; c < chunks; ++c)
+	{
+		size_t begin = first + count * c / chunks;
+		size_t end = first + count * (c + 1) / chunks;
+		tg.run([begin, end, &func]() {
+			for (size_t i = begin; i < end; ++i)
+				func(i);
+		});
+	}
+	tg.wait();
+}
+
+namespace detail
+{
+
+// Quicksort that sorts both sides of the pivot at the same time, until they
+// get small enough for std::sort. The pivot is swapped out of the way instead
+// of copied, so the elements only have to be movable.
+template<typename It, typename Compare>
+void parallelSort(It first, It last, const Compare& comp, ThreadPool& pool, int depth)
+{
+	const ptrdiff_t Cutoff = 4096;
+
+	if (last - first > Cutoff && depth > 0)
+	{
+		--depth;
+
+		It mid = first + (last - first) / 2;
+		It back = last - 1;
+		// Median of three ends up at the back
+		if (comp(*mid, *first))
+			std::iter_swap(mid, first);
+		if (comp(*back, *first))
+			std::iter_swap(back, first);
+		if (comp(*mid, *back))
+			std::iter_swap(mid, back);
+
+		auto& pivot = *back;
+		It lower = std::partition(first, back, [&](const typename std::iterator_traits<It>::value_type& v) { return comp(v, pivot); });
+		std::iter_swap(lower, back);
+		// Everything equal to the pivot is in place already, which keeps lots of
+		// duplicates from making one side as big as the whole
+		It upper = std::partition(lower + 1, last, [&](const typename std::iterator_traits<It>::value_type& v) { return !comp(*lower, v); });
+
+		TaskGroup tg(pool);
+		tg.run([first, lower, &comp, &pool, depth]() { parallelSort(first, lower, comp, pool, depth); });
+		parallelSort(upper, last, comp, pool, depth);
+		tg.wait();
+	}
+	else
+		std::sort(first, last, comp);
+}
+
+} // detail
+
+template<typename It, typename Compare>
+void parallelSort(It first, It last, const Compare& comp, ThreadPool& pool = ThreadPool::Default())
+{
+	if (pool.Workers() == 0)
+		std::sort(first, last, comp);
+	else
+		detail::parallelSort(first, last, comp, pool, 40);
+}
+
+template<typename It>
+void parallelSort(It first, It last)
+{
+	parallelSort(first, last, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+} // google_breakpad
@@ -22,17 +22,386 @@
 // Original author: Ted Mielczarek <ted@mielczarek.org>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <chrono>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <signal.h>
+#endif
+
+#include "BatchDumper.h"
+#include "DumpServer.h"
 #include "PDBParser.h"
+#include "Prefetcher.h"
+#include "ThreadPool.h"
+#include "utils.h"
+
+static void usage()
+{
+	fprintf(stderr,
+		"Usage: dump_syms [options] <pdb file>\n"
+		"       dump_syms [options] --pdb-name=NAME -\n"
+		"       dump_syms [options] --output-dir=DIR [--manifest=FILE] [<pdb file>...]\n"
+		"       dump_syms [options] --store=DIR [--manifest=FILE] [<pdb file>...]\n"
+		"       dump_syms [options] --serve=SOCKET\n"
+		"Options:\n"
+		"  -j N              Use N threads, by default one per CPU\n"
+		"  --io-stats        Report page faults and time taken to stderr\n"
+		"  --no-access-plan  Don't tell the OS which parts of the PDB will be read next\n"
+		"  --page-cache=MB   Read the PDB with pread through a page cache of at most MB\n"
+		"                    megabytes, instead of mapping it\n"
+		"  --map-window=MB   Map the PDB a window at a time, using at most MB megabytes\n"
+		"                    of address space, instead of mapping all of it\n"
+		"  --prefetch=N      Read the next N modules in the background while parsing\n"
+		"  --lazy-types      Only decode the types that functions refer to\n"
+		"  --time-limit=S    Give up on a PDB that takes more than S seconds\n"
+		"  --memory-limit=MB Give up on a PDB that needs more than MB megabytes of\n"
+		"                    records copied out of it\n"
+		"  --type-depth=N    Give up on types nested more than N deep\n"
+		"  --keep-partial    Instead of giving up, write the symbols of what was read\n"
+		"                    in time, leaving out the signatures of types too deep\n"
+		"  --pdb-name=NAME   The file name of a PDB read from stdin, which is what a\n"
+		"                    <pdb file> of - does\n"
+		"  --output-dir=DIR  Dump every PDB given to DIR/<name>.sym, sharing the\n"
+		"                    threads between all of them\n"
+		"  --store=DIR       Like --output-dir, but write to the symbol store layout of\n"
+		"                    DIR/<name>.pdb/<id>/<name>.sym\n"
+		"  --manifest=FILE   Also dump the PDBs listed in FILE, one per line\n"
+		"  --memory=MB       Only start another PDB while the ones being dumped are\n"
+		"                    estimated to fit in MB megabytes\n"
+		"  --serve=SOCKET    Dump PDBs for clients of a Unix domain socket until\n"
+		"                    interrupted\n");
+}
 
 int main(int argc, char** argv)
 {
-	if (argc != 2) {
-		fprintf(stderr, "Usage: dump_syms <pdb file>\n");
+	bool ioStats = false;
+	bool accessPlan = true;
+	bool lazyTypes = false;
+	size_t pageCache = 0;
+	size_t mapWindow = 0;
+	size_t prefetch = 0;
+	size_t threads = 0;
+	const char* pdbName = nullptr;
+	const char* outputDir = nullptr;
+	const char* storeDir = nullptr;
+	const char* serveSocket = nullptr;
+	const char* manifest = nullptr;
+	size_t memory = 0;
+	google_breakpad::ParseBudget budget;
+	std::vector<const char*> paths;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "-j", 2) == 0)
+		{
+			// Both -j N and -jN
+			const char* count = argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+			threads = (size_t)strtoul(count, nullptr, 10);
+			if (threads == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--io-stats") == 0)
+			ioStats = true;
+		else if (strcmp(argv[i], "--no-access-plan") == 0)
+			accessPlan = false;
+		else if (strcmp(argv[i], "--lazy-types") == 0)
+			lazyTypes = true;
+		else if (strncmp(argv[i], "--page-cache=", 13) == 0)
+		{
+			pageCache = (size_t)strtoul(argv[i] + 13, nullptr, 10) << 20;
+			if (pageCache == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--map-window=", 13) == 0)
+		{
+			mapWindow = (size_t)strtoul(argv[i] + 13, nullptr, 10) << 20;
+			if (mapWindow == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--prefetch=", 11) == 0)
+		{
+			prefetch = (size_t)strtoul(argv[i] + 11, nullptr, 10);
+			if (prefetch == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--time-limit=", 13) == 0)
+		{
+			budget.seconds = strtod(argv[i] + 13, nullptr);
+			if (budget.seconds <= 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--memory-limit=", 15) == 0)
+		{
+			budget.maxBytes = (uint64_t)strtoull(argv[i] + 15, nullptr, 10) << 20;
+			if (budget.maxBytes == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--type-depth=", 13) == 0)
+		{
+			budget.maxTypeDepth = (uint32_t)strtoul(argv[i] + 13, nullptr, 10);
+			if (budget.maxTypeDepth == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--keep-partial") == 0)
+			budget.partial = google_breakpad::ParseBudget::Truncate;
+		else if (strncmp(argv[i], "--pdb-name=", 11) == 0)
+			pdbName = argv[i] + 11;
+		else if (strncmp(argv[i], "--output-dir=", 13) == 0)
+			outputDir = argv[i] + 13;
+		else if (strncmp(argv[i], "--serve=", 8) == 0)
+			serveSocket = argv[i] + 8;
+		else if (strncmp(argv[i], "--store=", 8) == 0)
+			storeDir = argv[i] + 8;
+		else if (strncmp(argv[i], "--manifest=", 11) == 0)
+			manifest = argv[i] + 11;
+		else if (strncmp(argv[i], "--memory=", 9) == 0)
+		{
+			memory = (size_t)strtoul(argv[i] + 9, nullptr, 10) << 20;
+			if (memory == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (argv[i][0] == '-' && argv[i][1] != 0)
+		{
+			usage();
+			return 1;
+		}
+		else
+			paths.push_back(argv[i]);
+	}
+
+	if (outputDir && storeDir)
+	{
+		usage();
+		return 1;
+	}
+
+	bool store = storeDir && *storeDir;
+	bool batch = (outputDir && *outputDir) || store;
+	bool serve = serveSocket && *serveSocket;
+	if (serve)
+	{
+		if (batch || !paths.empty() || manifest || memory || pdbName)
+		{
+			usage();
+			return 1;
+		}
+	}
+	else if (batch)
+	{
+		if ((paths.empty() && !manifest) || pdbName)
+		{
+			usage();
+			return 1;
+		}
+		for (auto p : paths)
+		{
+			if (strcmp(p, "-") == 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+	}
+	else if (paths.size() != 1 || manifest || memory)
+	{
+		usage();
 		return 1;
 	}
+
+	const char* path = paths.empty() ? nullptr : paths[0];
+	bool fromStdin = path && strcmp(path, "-") == 0;
+	if (fromStdin && (!pdbName || !*pdbName)) {
+		usage();
+		return 1;
+	}
+
+#ifdef HAVE_TBB
+	if (threads)
+		fprintf(stderr, "Built to use TBB, -j is ignored\n");
+#else
+	google_breakpad::ThreadPool::SetDefaultThreads(threads);
+#endif
+
+	PageFaults before = {};
+	getPageFaults(before);
+	auto start = std::chrono::steady_clock::now();
+
+	auto setup = [=](google_breakpad::PDBParser& parser) {
+		parser.useAccessPlan(accessPlan);
+		parser.usePageCache(pageCache);
+		parser.useWindowedMapping(mapWindow);
+		parser.usePrefetcher(prefetch);
+		parser.useLazyTypes(lazyTypes);
+		parser.setBudget(budget);
+	};
+
+	if (serve)
+	{
+#ifdef _WIN32
+		fprintf(stderr, "--serve isn't supported on Windows\n");
+		return 1;
+#else
+		// Blocked before any threads start so that they all inherit it, and
+		// only this thread ever sees them
+		sigset_t stop;
+		sigemptyset(&stop);
+		sigaddset(&stop, SIGINT);
+		sigaddset(&stop, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &stop, nullptr);
+
+		google_breakpad::DumpServer server(setup);
+		if (!server.Start(serveSocket))
+			return 1;
+		fprintf(stderr, "Listening on %s\n", serveSocket);
+
+		int sig;
+		sigwait(&stop, &sig);
+		server.Stop();
+
+		if (ioStats)
+		{
+			fprintf(stderr, "io-stats: served %llu requests with %u parsers\n",
+				(unsigned long long)server.Requests(), (uint32_t)server.ParsersCreated());
+		}
+		return 0;
+#endif
+	}
+
+	if (batch)
+	{
+		google_breakpad::BatchDumper dumper(store ? storeDir : outputDir, memory, setup);
+		dumper.useSymbolStore(store);
+
+		if (manifest && !dumper.AddManifest(manifest))
+		{
+			fprintf(stderr, "Failed to read %s\n", manifest);
+			return 1;
+		}
+		for (auto p : paths)
+			dumper.Add(p);
+
+		size_t failed = dumper.Run();
+
+		if (ioStats)
+		{
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			fprintf(stderr, "io-stats: %lld ms, %llu MB estimated in flight at most, %u parsers\n", (long long)ms,
+				(unsigned long long)(dumper.PeakBytes() >> 20), (uint32_t)dumper.ParsersCreated());
+		}
+
+		return failed ? 1 : 0;
+	}
+
 	google_breakpad::PDBParser parser;
-	parser.load(argv[1]);
-	parser.printBreakpadSymbols(stdout);
+	setup(parser);
+	if (fromStdin)
+	{
+#ifdef _WIN32
+		int fd = _fileno(stdin);
+		_setmode(fd, _O_BINARY);
+#else
+		int fd = fileno(stdin);
+#endif
+		parser.load(fd, pdbName);
+	}
+	else
+		parser.load(path);
+	try
+	{
+		parser.printBreakpadSymbols(stdout);
+	}
+	catch (const google_breakpad::BudgetExceeded& e)
+	{
+		fflush(stdout);
+		fprintf(stderr, "Gave up on %s: %s\n", path, e.what());
+		return 1;
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "Failed to dump %s: %s\n", path, e.what());
+		return 1;
+	}
+
+	if (ioStats)
+	{
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+		PageFaults after = {};
+		if (getPageFaults(after))
+		{
+			fprintf(stderr, "io-stats: %llu major faults, %llu minor faults, %lld ms, access plan %s\n",
+				(unsigned long long)(after.major - before.major), (unsigned long long)(after.minor - before.minor),
+				(long long)ms, accessPlan && parser.data() ? "on" : "off");
+		}
+		else
+			fprintf(stderr, "io-stats: %lld ms, page faults not available\n", (long long)ms);
+
+		auto& types = parser.typeStats();
+		fprintf(stderr, "io-stats: decoded %u of %u type records, type names %llu cache hits, %llu misses\n",
+			types.decoded, types.types, (unsigned long long)types.nameHits, (unsigned long long)types.nameMisses);
+
+		auto& strings = parser.strings();
+		fprintf(stderr, "io-stats: %llu names, %llu of them different\n",
+			(unsigned long long)strings.Lookups(), (unsigned long long)strings.Strings());
+
+		if (pageCache)
+		{
+			auto& cache = parser.pageCache();
+			fprintf(stderr, "io-stats: page cache %llu hits, %llu misses\n",
+				(unsigned long long)cache.Hits(), (unsigned long long)cache.Misses());
+		}
+
+		auto& windows = parser.windowedMapping();
+		if (windows.Valid())
+		{
+			fprintf(stderr, "io-stats: mapped %llu windows of %llu KB\n",
+				(unsigned long long)windows.Maps(), (unsigned long long)(windows.WindowSize() >> 10));
+		}
+
+		if (fromStdin)
+		{
+			auto& pipe = parser.pipe();
+			fprintf(stderr, "io-stats: %u pages received from stdin, %u kept\n", pipe.PagesReceived(), pipe.PagesKept());
+		}
+
+		if (auto prefetcher = parser.prefetcher())
+		{
+			fprintf(stderr, "io-stats: prefetched %llu KB with %s, %.1f ms waiting on I/O\n",
+				(unsigned long long)(prefetcher->BytesRead() >> 10), prefetcher->UsingIoUring() ? "io_uring" : "threads",
+				prefetcher->WaitSeconds() * 1000.0);
+		}
+	}
+
 	return 0;
 }
@@ -1,7 +1,11 @@
 # -*- Mode: python; indent-tabs-mode: nil; -*-
 {
     'variables': {
+        # The built in thread pool is used unless this is set to 1 and TBB is found
+        'use_tbb%': 0,
         'have_tbb': '<!(python wrap-pkg-config.py --atleast-version=2.2 tbb)',
+        'have_zlib': '<!(python wrap-pkg-config.py zlib)',
+        'have_zstd': '<!(python wrap-pkg-config.py libzstd)',
     },
     'target_defaults': {
         'xcode_settings': {
@@ -27,9 +31,13 @@
                     '-Wall',
                     '-Werror',
                     '-std=gnu++0x',
+                    '-pthread',
+                ],
+                'ldflags': [
+                    '-pthread',
                 ],
             }],
-            ['<(have_tbb)==1', {
+            ['<(use_tbb)==1 and <(have_tbb)==1', {
                 'cflags': [
                     '<!@(pkg-config --cflags tbb)',
                 ],
@@ -40,6 +48,28 @@
                     'HAVE_TBB',
                 ],
             }],
+            ['<(have_zlib)==1', {
+                'cflags': [
+                    '<!@(pkg-config --cflags zlib)',
+                ],
+                'libraries': [
+                    '<!@(pkg-config --libs zlib)',
+                ],
+                'defines': [
+                    'HAVE_ZLIB',
+                ],
+            }],
+            ['<(have_zstd)==1', {
+                'cflags': [
+                    '<!@(pkg-config --cflags libzstd)',
+                ],
+                'libraries': [
+                    '<!@(pkg-config --libs libzstd)',
+                ],
+                'defines': [
+                    'HAVE_ZSTD',
+                ],
+            }],
     ]  # conditions
     }, # target_defaults
     'targets': [
@@ -57,7 +87,13 @@
       'target_name': 'pdb_parser',
       'type': 'static_library',
       'sources': [
+            'BatchDumper.cpp',
+            'ChunkWriter.cpp',
+            'DumpServer.cpp',
             'PDBParser.cpp',
+            'Prefetcher.cpp',
+            'StreamReader.cpp',
+            'ThreadPool.cpp',
             'utils.cpp',
       ],
       'direct_dependent_settings': {
@@ -94,5 +130,18 @@
             'pdb_parser',
         ],
     },
+    {
+        'target_name': 'dump_syms_benchmark',
+        'type': 'executable',
+        'sources': [
+            'testing/dump_syms_benchmark.cpp',
+        ],
+        'include_dirs': [
+            'testing',
+        ],
+        'dependencies': [
+            'pdb_parser',
+        ],
+    },
     ]
 }
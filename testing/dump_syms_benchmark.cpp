@@ -0,0 +1,513 @@
+/* -*- Mode: C++; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+// Microbenchmarks for the PDB reading hot paths. Run with no arguments to list
+// the available benchmarks.
+
+#include "PDBParser.h"
+#include "StreamReader.h"
+#include "ThreadPool.h"
+#include "msf_writer.h"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using google_breakpad::PDBParser;
+using google_breakpad::StreamReader;
+using std::string;
+
+// Heap allocations are counted by wrapping malloc, which only glibc makes easy
+#ifdef __GLIBC__
+namespace {
+std::atomic<uint64_t> g_mallocs(0);
+}
+
+extern "C" void* __libc_malloc(size_t size);
+
+extern "C" void* malloc(size_t size) __THROW
+{
+	g_mallocs.fetch_add(1, std::memory_order_relaxed);
+	return __libc_malloc(size);
+}
+#define COUNTS_MALLOCS 1
+#endif
+
+namespace {
+
+// Results get written here so the timed loops can't be optimized away
+volatile uintptr_t g_sink;
+
+string temp_path(const char* name)
+{
+#ifdef _WIN32
+	const char* dir = getenv("TEMP");
+	const char sep = '\\';
+#else
+	const char* dir = getenv("TMPDIR");
+	const char sep = '/';
+	if (!dir)
+		dir = "/tmp";
+#endif
+	string path(dir ? dir : ".");
+	path += sep;
+	path += name;
+	return path;
+}
+
+double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Random seeks across one big stream. Only the page table is touched, so the
+// stream can be left as a hole in a sparse file and still be gigabytes long.
+int bench_seek(int argc, char** argv)
+{
+	const uint32_t pageSize = 4096;
+	const uint32_t numSeeks = 1000000;
+	uint64_t maxSize = (argc > 0 ? strtoull(argv[0], nullptr, 10) : 2048) << 20;
+	if (maxSize > 0xF0000000)
+		maxSize = 0xF0000000;
+
+	string path = temp_path("dump_syms_bench_seek.pdb");
+
+	printf("%-12s %-12s %10s %12s\n", "stream MB", "layout", "runs", "ns/seek");
+
+	for (uint64_t size = 16 << 20; size <= maxSize; size *= 4)
+	{
+		for (int layout = msf_writer::Sequential; layout <= msf_writer::Interleaved; ++layout)
+		{
+			std::vector<msf_writer::Stream> streams;
+			streams.push_back(msf_writer::Stream());
+			streams.push_back(msf_writer::infoStream());
+			streams.push_back(msf_writer::Stream((uint32_t)size));
+			// A second stream to interleave with, so every page of the first is its own run
+			if (layout == msf_writer::Interleaved)
+				streams.push_back(msf_writer::Stream((uint32_t)size));
+
+			if (!msf_writer::write(path.c_str(), streams, pageSize, (msf_writer::Layout)layout))
+			{
+				fprintf(stderr, "Failed to write %s\n", path.c_str());
+				return 1;
+			}
+
+			{
+				PDBParser parser;
+				parser.load(path.c_str());
+
+				auto& stream = parser.getStream(2);
+				StreamReader reader(stream, parser);
+
+				std::mt19937 rng(1234);
+				std::uniform_int_distribution<uint32_t> dist(0, stream.size - 1);
+				std::vector<uint32_t> offsets(numSeeks);
+				for (auto& o : offsets)
+					o = dist(rng);
+
+				uintptr_t sink = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (auto o : offsets)
+				{
+					reader.seek(o);
+					sink += (uintptr_t)reader.getData();
+				}
+				double ns = elapsed_ns(start);
+				g_sink = sink;
+
+				printf("%-12u %-12s %10u %12.1f\n", (uint32_t)(size >> 20),
+					layout == msf_writer::Sequential ? "contiguous" : "fragmented",
+					(uint32_t)stream.runs.size(), ns / numSeeks);
+			}
+
+			remove(path.c_str());
+		}
+	}
+
+	return 0;
+}
+
+// Dumps a PDB rewritten with tiny interleaved pages, so that most records
+// straddle a page boundary, and counts the heap allocations made with and
+// without arenas for every way of reading the file.
+int bench_allocs(int argc, char** argv)
+{
+	string source = argc > 0 ? argv[0] : "testing/testdata/TestApp.pdb";
+	string path = temp_path("dump_syms_bench_allocs.pdb");
+
+	{
+		PDBParser parser;
+		parser.load(source.c_str());
+
+		std::vector<msf_writer::Stream> streams;
+		msf_writer::readStreams(parser, streams);
+		if (!msf_writer::write(path.c_str(), streams, 512, msf_writer::Interleaved))
+		{
+			fprintf(stderr, "Failed to write %s\n", path.c_str());
+			return 1;
+		}
+	}
+
+	FILE* null = fopen(
+#ifdef _WIN32
+		"NUL",
+#else
+		"/dev/null",
+#endif
+		"w");
+	if (!null)
+		return 1;
+
+	printf("%-12s %-8s %14s %10s\n", "access", "arena", "allocations", "ms");
+
+	const char* names[] = { "mapped", "page cache", "windows" };
+	for (int access = 0; access < 3; ++access)
+	{
+		for (int useArena = 0; useArena < 2; ++useArena)
+		{
+			PDBParser parser;
+			parser.useArena(useArena != 0);
+			if (access == 1)
+				parser.usePageCache(1 << 20);
+			else if (access == 2)
+				parser.useWindowedMapping(1 << 20);
+			parser.load(path.c_str());
+
+#ifdef COUNTS_MALLOCS
+			uint64_t before = g_mallocs.load();
+#endif
+			auto start = std::chrono::steady_clock::now();
+			parser.printBreakpadSymbols(null);
+			double ns = elapsed_ns(start);
+
+#ifdef COUNTS_MALLOCS
+			printf("%-12s %-8s %14llu %10.2f\n", names[access], useArena ? "on" : "off",
+				(unsigned long long)(g_mallocs.load() - before), ns / 1e6);
+#else
+			printf("%-12s %-8s %14s %10.2f\n", names[access], useArena ? "on" : "off", "-", ns / 1e6);
+#endif
+		}
+	}
+
+	fclose(null);
+	remove(path.c_str());
+	return 0;
+}
+
+// Times readString with every NUL scanner the CPU supports, first by dumping
+// a real PDB, then on a stream of very long template names that straddle
+// page runs, like the ones heavily templated code ends up with.
+int bench_strings(int argc, char** argv)
+{
+	string source = argc > 0 ? argv[0] : "testing/testdata/TestApp.pdb";
+
+	const google_breakpad::NulScan scans[] = {
+		google_breakpad::NulScan::Scalar,
+		google_breakpad::NulScan::SSE2,
+		google_breakpad::NulScan::AVX2,
+	};
+	const char* names[] = { "scalar", "sse2", "avx2" };
+
+	FILE* null = fopen(
+#ifdef _WIN32
+		"NUL",
+#else
+		"/dev/null",
+#endif
+		"w");
+	if (!null)
+		return 1;
+
+	printf("%-8s %16s\n", "scan", "ms/dump");
+	for (int i = 0; i < 3; ++i)
+	{
+		if (!google_breakpad::setNulScan(scans[i]))
+			continue;
+
+		// Best of a few, a dump this small is over quickly
+		double best = 0;
+		for (int run = 0; run < 20; ++run)
+		{
+			PDBParser parser;
+			parser.load(source.c_str());
+
+			auto start = std::chrono::steady_clock::now();
+			parser.printBreakpadSymbols(null);
+			double ns = elapsed_ns(start);
+			if (run == 0 || ns < best)
+				best = ns;
+		}
+
+		printf("%-8s %16.3f\n", names[i], best / 1e6);
+	}
+	fclose(null);
+
+	const uint32_t pageSize = 4096;
+	const uint32_t numNames = 20000;
+	string path = temp_path("dump_syms_bench_strings.pdb");
+
+	msf_writer::Stream templates;
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<uint32_t> depth(4, 60);
+	for (uint32_t n = 0; n < numNames; ++n)
+	{
+		string name = "std::vector<";
+		uint32_t d = depth(rng);
+		for (uint32_t j = 0; j < d; ++j)
+			name += "std::pair<std::basic_string<char,std::char_traits<char>,std::allocator<char> >,";
+		name += "int";
+		for (uint32_t j = 0; j < d; ++j)
+			name += "> ";
+		name += ">";
+		templates.data.insert(templates.data.end(), name.begin(), name.end());
+		templates.data.push_back(0);
+	}
+	templates.size = (uint32_t)templates.data.size();
+
+	std::vector<msf_writer::Stream> streams;
+	streams.push_back(msf_writer::Stream());
+	streams.push_back(msf_writer::infoStream());
+	streams.push_back(templates);
+	streams.push_back(msf_writer::Stream(templates.size));
+	if (!msf_writer::write(path.c_str(), streams, pageSize, msf_writer::Interleaved))
+	{
+		fprintf(stderr, "Failed to write %s\n", path.c_str());
+		return 1;
+	}
+
+	printf("\n%u names, %.1f KB on average\n", numNames, templates.size / 1024.0 / numNames);
+	printf("%-8s %16s %12s\n", "scan", "ns/name", "GB/s");
+	{
+		PDBParser parser;
+		parser.load(path.c_str());
+		auto& stream = parser.getStream(2);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			if (!google_breakpad::setNulScan(scans[i]))
+				continue;
+
+			double best = 0;
+			for (int run = 0; run < 5; ++run)
+			{
+				StreamReader reader(stream, parser);
+				uintptr_t sink = 0;
+
+				auto start = std::chrono::steady_clock::now();
+				for (uint32_t n = 0; n < numNames; ++n)
+					sink += (uintptr_t)reader.readString().data;
+				double ns = elapsed_ns(start);
+				g_sink = sink;
+
+				if (run == 0 || ns < best)
+					best = ns;
+			}
+
+			printf("%-8s %16.1f %12.2f\n", names[i], best / numNames, templates.size / best);
+		}
+	}
+
+	google_breakpad::setNulScan(google_breakpad::NulScan::Best);
+	remove(path.c_str());
+	return 0;
+}
+
+// Best time of a few full dumps of source with the default pool as it is
+double time_dump(const string& source, FILE* out)
+{
+	double best = 0;
+	for (int run = 0; run < 10; ++run)
+	{
+		PDBParser parser;
+		parser.load(source.c_str());
+
+		auto start = std::chrono::steady_clock::now();
+		parser.printBreakpadSymbols(out);
+		double ns = elapsed_ns(start);
+		if (run == 0 || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+// Times whole dumps with 1 to N threads, to see how well the parallel steps,
+// formatting the functions above all, scale. The default pool can only be
+// sized once, so every thread count gets a process of its own.
+int bench_scaling(int argc, char** argv)
+{
+	string source = argc > 0 ? argv[0] : "testing/testdata/TestApp.pdb";
+	size_t maxThreads = argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	FILE* null = fopen(
+#ifdef _WIN32
+		"NUL",
+#else
+		"/dev/null",
+#endif
+		"w");
+	if (!null)
+		return 1;
+
+	printf("%-8s %12s %10s\n", "threads", "ms/dump", "speedup");
+
+#ifdef _WIN32
+	// No fork, so only the default pool gets timed
+	(void)maxThreads;
+	printf("%-8u %12.3f %10.2f\n", (uint32_t)google_breakpad::ThreadPool::Default().Workers() + 1,
+		time_dump(source, null) / 1e6, 1.0);
+#else
+	double base = 0;
+	for (size_t threads = 1; threads <= maxThreads; ++threads)
+	{
+		int fds[2];
+		if (pipe(fds) != 0)
+			return 1;
+
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid < 0)
+			return 1;
+
+		if (pid == 0)
+		{
+			close(fds[0]);
+			google_breakpad::ThreadPool::SetDefaultThreads(threads);
+			double ns = time_dump(source, null);
+			ssize_t written = write(fds[1], &ns, sizeof(ns));
+			_exit(written == (ssize_t)sizeof(ns) ? 0 : 1);
+		}
+
+		close(fds[1]);
+		double ns = 0;
+		ssize_t got = read(fds[0], &ns, sizeof(ns));
+		close(fds[0]);
+
+		int status = 0;
+		waitpid(pid, &status, 0);
+		if (got != (ssize_t)sizeof(ns) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			fprintf(stderr, "Failed to time %u threads\n", (uint32_t)threads);
+			return 1;
+		}
+
+		if (threads == 1)
+			base = ns;
+		printf("%-8u %12.3f %10.2f\n", (uint32_t)threads, ns / 1e6, base / ns);
+	}
+#endif
+
+	fclose(null);
+	return 0;
+}
+
+// Dumps a PDB with every type decoded up front and then with only the ones
+// functions refer to, decoded as they're needed, and shows how many of the
+// types stringized came from the cache of type names.
+int bench_types(int argc, char** argv)
+{
+	string source = argc > 0 ? argv[0] : "testing/testdata/TestApp.pdb";
+
+	FILE* null = fopen(
+#ifdef _WIN32
+		"NUL",
+#else
+		"/dev/null",
+#endif
+		"w");
+	if (!null)
+		return 1;
+
+	printf("%-8s %12s %12s %12s %12s\n", "types", "ms/dump", "decoded", "of", "name hits");
+	for (int lazy = 0; lazy < 2; ++lazy)
+	{
+		double best = 0;
+		PDBParser::TypeStats stats = {};
+		for (int run = 0; run < 10; ++run)
+		{
+			PDBParser parser;
+			parser.useLazyTypes(lazy != 0);
+			parser.load(source.c_str());
+
+			auto start = std::chrono::steady_clock::now();
+			parser.printBreakpadSymbols(null);
+			double ns = elapsed_ns(start);
+			if (run == 0 || ns < best)
+				best = ns;
+			stats = parser.typeStats();
+		}
+
+		double hits = stats.nameHits + stats.nameMisses ? 100.0 * stats.nameHits / (stats.nameHits + stats.nameMisses) : 0;
+		printf("%-8s %12.3f %12u %12u %11.1f%%\n", lazy ? "lazy" : "eager", best / 1e6, stats.decoded, stats.types, hits);
+	}
+
+	fclose(null);
+	return 0;
+}
+
+struct Benchmark
+{
+	const char* name;
+	const char* usage;
+	int (*run)(int argc, char** argv);
+};
+
+const Benchmark benchmarks[] = {
+	{ "seek", "[max stream MB]", bench_seek },
+	{ "allocs", "[pdb]", bench_allocs },
+	{ "strings", "[pdb]", bench_strings },
+	{ "scaling", "[pdb] [max threads]", bench_scaling },
+	{ "types", "[pdb]", bench_types },
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc >= 2)
+	{
+		for (auto& b : benchmarks)
+		{
+			if (strcmp(argv[1], b.name) == 0)
+				return b.run(argc - 2, argv + 2);
+		}
+	}
+
+	fprintf(stderr, "Usage: dump_syms_benchmark <benchmark> [args]\n");
+	for (auto& b : benchmarks)
+		fprintf(stderr, "  %s %s\n", b.name, b.usage);
+	return 1;
+}
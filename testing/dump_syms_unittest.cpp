@@ -24,15 +24,48 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "BatchDumper.h"
+#include "ChunkWriter.h"
+#include "DumpServer.h"
 #include "PDBParser.h"
+#include "Prefetcher.h"
+#include "StreamReader.h"
+#include "ThreadPool.h"
+#include "msf_writer.h"
+#include "utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
 #include "memstream_win.h"
+#else
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
 #endif
 
 #ifdef __APPLE__
@@ -43,6 +76,12 @@ extern "C" {
 
 using std::string;
 namespace {
+
+#ifndef HAVE_TBB
+// Whatever machine the tests run on, the parallel paths get exercised. This
+// has to happen before anything uses the default pool.
+const bool s_threadsSet = (google_breakpad::ThreadPool::SetDefaultThreads(4), true);
+#endif
 #ifdef _WIN32
 const char PATHSEP = '\\';
 #else
@@ -87,6 +126,147 @@ bool read_file(const string& filename, string& buffer)
 #endif
 }
 
+// Makes a scratch directory, so that PDBs written by the tests can keep
+// the TestApp name which ends up in the MODULE line
+string make_temp_dir(const char* name)
+{
+#ifdef _WIN32
+	const char* tmp = getenv("TEMP");
+#else
+	const char* tmp = getenv("TMPDIR");
+	if (!tmp)
+		tmp = "/tmp";
+#endif
+	string dir(tmp ? tmp : ".");
+	join(dir, name);
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+	return dir;
+}
+
+void print_symbols(google_breakpad::PDBParser& parser, string& output)
+{
+	char* buffer = nullptr;
+	size_t buffer_size;
+	FILE* out_file = open_memstream(&buffer, &buffer_size);
+	ASSERT_TRUE(out_file);
+	try
+	{
+		parser.printBreakpadSymbols(out_file);
+	}
+	catch (...)
+	{
+		fclose(out_file);
+		free(buffer);
+		throw;
+	}
+	fclose(out_file);
+#ifdef _WIN32
+	ASSERT_TRUE(close_memstream(out_file));
+#endif
+	output.assign(buffer, buffer_size);
+	free(buffer);
+}
+
+void dump_pdb(const string& pdb, string& output)
+{
+	google_breakpad::PDBParser parser;
+	parser.load(pdb.c_str());
+	print_symbols(parser, output);
+}
+
+// Writes a file into a pipe from a thread of its own. The last holdBack bytes
+// aren't written until release is called, or a few seconds have passed so that
+// a reader that needs all of the file doesn't hang the test.
+class PipeFeeder
+{
+public:
+	PipeFeeder(const string& filename, size_t holdBack)
+		: m_released(false)
+	{
+		read_file(filename, m_data);
+		m_holdBack = std::min(holdBack, m_data.size());
+#ifdef _WIN32
+		_pipe(m_fds, 65536, _O_BINARY);
+#else
+		if (pipe(m_fds) != 0)
+			m_fds[0] = m_fds[1] = -1;
+#endif
+		m_thread = std::thread([this] { feed(); });
+	}
+
+	~PipeFeeder()
+	{
+		release();
+		m_thread.join();
+#ifdef _WIN32
+		_close(m_fds[0]);
+#else
+		close(m_fds[0]);
+#endif
+	}
+
+	int fd() const { return m_fds[0]; }
+
+	// False if the held back bytes had to be written because nobody released them
+	bool release()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		bool inTime = !m_released;
+		m_released = true;
+		m_release.notify_all();
+		return inTime;
+	}
+
+private:
+	void write(const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+#ifdef _WIN32
+			int written = _write(m_fds[1], data, (unsigned)size);
+#else
+			ssize_t written = ::write(m_fds[1], data, size);
+#endif
+			if (written <= 0)
+				return;
+			data += written;
+			size -= written;
+		}
+	}
+
+	void feed()
+	{
+		size_t first = m_data.size() - m_holdBack;
+		write(m_data.data(), first);
+
+		if (m_holdBack)
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_release.wait_for(lock, std::chrono::seconds(5), [this] { return m_released; });
+			m_released = true;
+		}
+
+		write(m_data.data() + first, m_holdBack);
+#ifdef _WIN32
+		_close(m_fds[1]);
+#else
+		close(m_fds[1]);
+#endif
+	}
+
+	string					m_data;
+	size_t					m_holdBack;
+	int						m_fds[2];
+	std::thread				m_thread;
+	std::mutex				m_lock;
+	std::condition_variable	m_release;
+	bool					m_released;
+};
+
 #if 0
 // For debugging...
 void write_file(const string& filename, const char* buffer, size_t size)
@@ -131,3 +311,1259 @@ TEST(DumpSyms, SimpleTest)
 	ASSERT_EQ(expected, actual);
 	free(buffer);
 }
+
+TEST(DumpSyms, FragmentedLayouts)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	std::vector<msf_writer::Stream> streams;
+	uint32_t pageSize;
+	{
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		pageSize = parser.pageSize();
+		msf_writer::readStreams(parser, streams);
+	}
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	string rewritten = make_temp_dir("dump_syms_fragmented");
+	join(rewritten, "TestApp.pdb");
+
+	// Every record that crosses a page boundary now crosses a run boundary too
+	const msf_writer::Layout layouts[] = { msf_writer::Interleaved, msf_writer::Reversed };
+	for (auto layout : layouts)
+	{
+		ASSERT_TRUE(msf_writer::write(rewritten.c_str(), streams, pageSize, layout));
+
+		string actual;
+		dump_pdb(rewritten, actual);
+		ASSERT_EQ(expected, actual) << "layout " << layout;
+	}
+
+	remove(rewritten.c_str());
+}
+
+TEST(DumpSyms, StreamViews)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	std::vector<msf_writer::Stream> streams;
+	uint32_t pageSize;
+	{
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		pageSize = parser.pageSize();
+		msf_writer::readStreams(parser, streams);
+	}
+
+	string rewritten = make_temp_dir("dump_syms_views");
+	join(rewritten, "TestApp.pdb");
+
+	const msf_writer::Layout layouts[] = { msf_writer::Sequential, msf_writer::Interleaved };
+	for (auto layout : layouts)
+	{
+		ASSERT_TRUE(msf_writer::write(rewritten.c_str(), streams, pageSize, layout));
+
+		google_breakpad::PDBParser parser;
+		parser.load(rewritten.c_str());
+
+		for (uint32_t i = 0; i < streams.size(); ++i)
+		{
+			auto view = parser.getStreamView(i);
+			ASSERT_EQ(streams[i].size, view.size());
+			if (view.size() == 0)
+				continue;
+
+			ASSERT_EQ(0, memcmp(streams[i].data.data(), view.data(), view.size())) << "stream " << i;
+
+			// Multi-page streams are only contiguous in the sequential layout,
+			// otherwise they are copied once and shared
+			bool mapped = layout == msf_writer::Sequential || view.size() <= pageSize;
+			ASSERT_EQ(mapped, view.isMapped()) << "stream " << i;
+			ASSERT_EQ(view.data(), parser.getStreamView(i).data()) << "stream " << i;
+		}
+	}
+
+	remove(rewritten.c_str());
+}
+
+TEST(DumpSyms, PageCache)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// Small enough that pages get evicted while records on them are still in use
+	google_breakpad::PDBParser parser;
+	parser.usePageCache(4 * 1024);
+	parser.load(test_pdb.c_str());
+	ASSERT_EQ(nullptr, parser.data());
+
+	char* buffer = nullptr;
+	size_t buffer_size;
+	FILE* out_file = open_memstream(&buffer, &buffer_size);
+	ASSERT_TRUE(out_file);
+	parser.printBreakpadSymbols(out_file);
+	fclose(out_file);
+#ifdef _WIN32
+	ASSERT_TRUE(close_memstream(out_file));
+#endif
+	string actual(buffer, buffer_size);
+	free(buffer);
+
+	ASSERT_EQ(expected, actual);
+	ASSERT_GT(parser.pageCache().Misses(), 0u);
+}
+
+#ifndef _WIN32
+TEST(DumpSyms, AccessPlan)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// The page faults a dump takes, the fewest of a few runs to leave out
+	// whatever else the process happened to be doing
+	auto faults = [&](bool plan) {
+		uint64_t fewest = ~0ull;
+		for (int run = 0; run < 5; ++run)
+		{
+			PageFaults before, after;
+			EXPECT_TRUE(getPageFaults(before));
+			{
+				google_breakpad::PDBParser parser;
+				parser.useAccessPlan(plan);
+				parser.load(test_pdb.c_str());
+
+				char* buffer = nullptr;
+				size_t buffer_size;
+				FILE* out_file = open_memstream(&buffer, &buffer_size);
+				EXPECT_TRUE(out_file);
+				parser.printBreakpadSymbols(out_file);
+				fclose(out_file);
+				EXPECT_EQ(expected, string(buffer, buffer_size));
+				free(buffer);
+			}
+			EXPECT_TRUE(getPageFaults(after));
+			fewest = std::min(fewest, after.minor + after.major - before.minor - before.major);
+		}
+		return fewest;
+	};
+
+	// The hints mustn't cost faults, by dropping pages that are still to be
+	// read or otherwise
+	faults(true);
+	uint64_t without = faults(false);
+	uint64_t with = faults(true);
+	ASSERT_LE(with, without + without / 10 + 2) << with << " page faults with the access plan, " << without << " without";
+}
+#endif
+
+TEST(DumpSyms, Prefetch)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	google_breakpad::PDBParser parser;
+	parser.usePrefetcher(2);
+	parser.load(test_pdb.c_str());
+
+	char* buffer = nullptr;
+	size_t buffer_size;
+	FILE* out_file = open_memstream(&buffer, &buffer_size);
+	ASSERT_TRUE(out_file);
+	parser.printBreakpadSymbols(out_file);
+	fclose(out_file);
+#ifdef _WIN32
+	ASSERT_TRUE(close_memstream(out_file));
+#endif
+	string actual(buffer, buffer_size);
+	free(buffer);
+
+	ASSERT_EQ(expected, actual);
+	ASSERT_NE(nullptr, parser.prefetcher());
+	ASSERT_GT(parser.prefetcher()->BytesRead(), 0u);
+
+	// Every stream is a step, read through the thread pool whatever the platform
+	google_breakpad::Prefetcher::Plan plan;
+	uint64_t total = 0;
+	for (size_t i = 0; i < parser.streamCount(); ++i)
+	{
+		auto& stream = parser.getStream((int)i);
+		std::vector<google_breakpad::MMapWrapper::Range> ranges;
+		for (auto& run : stream.runs)
+		{
+			google_breakpad::MMapWrapper::Range range = { (uint64_t)run.page * parser.pageSize(), std::min(run.size, stream.size - run.offset) };
+			ranges.push_back(range);
+			total += range.size;
+		}
+		plan.push_back(ranges);
+	}
+
+	google_breakpad::Prefetcher prefetcher;
+	ASSERT_TRUE(prefetcher.Start(test_pdb.c_str(), plan, 3, false));
+	ASSERT_FALSE(prefetcher.UsingIoUring());
+	for (size_t i = 0; i < plan.size(); ++i)
+		prefetcher.BeginStep(i);
+	prefetcher.Stop();
+
+	ASSERT_EQ(total, prefetcher.BytesRead());
+
+	// Steps can be begun from several threads at once, in any order, with
+	// either way of reading
+	for (bool allowIoUring : { false, true })
+	{
+		ASSERT_TRUE(prefetcher.Start(test_pdb.c_str(), plan, 3, allowIoUring));
+		std::vector<std::thread> decoders;
+		for (size_t t = 0; t < 4; ++t)
+		{
+			decoders.emplace_back([&prefetcher, &plan, t]() {
+				for (size_t i = t; i < plan.size(); i += 4)
+					prefetcher.BeginStep(i);
+			});
+		}
+		for (auto& d : decoders)
+			d.join();
+		prefetcher.Stop();
+	}
+}
+
+TEST(DumpSyms, Pipe)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// The linker put the directory at the end, so all of it has to arrive first
+	std::vector<msf_writer::Stream> streams;
+	uint32_t pageSize;
+	{
+		PipeFeeder feeder(test_pdb, 0);
+		google_breakpad::PDBParser parser;
+		parser.load(feeder.fd(), test_pdb.c_str());
+		pageSize = parser.pageSize();
+		msf_writer::readStreams(parser, streams);
+
+		// Only the streams the dump reads are held on to once it gets going
+		string actual;
+		print_symbols(parser, actual);
+		ASSERT_EQ(expected, actual);
+		ASSERT_LT(parser.pipe().PagesKept(), parser.pipe().PagesReceived());
+	}
+
+	// With the directory up front it can be loaded while half of it is still to come
+	string rewritten = make_temp_dir("dump_syms_pipe");
+	join(rewritten, "TestApp.pdb");
+	ASSERT_TRUE(msf_writer::write(rewritten.c_str(), streams, pageSize, msf_writer::Sequential, true));
+
+	{
+		FILE* f = fopen(rewritten.c_str(), "rb");
+		ASSERT_TRUE(f);
+		fseek(f, 0, SEEK_END);
+		size_t size = (size_t)ftell(f);
+		fclose(f);
+
+		PipeFeeder feeder(rewritten, size / 2);
+		google_breakpad::PDBParser parser;
+		parser.load(feeder.fd(), test_pdb.c_str());
+		ASSERT_TRUE(feeder.release());
+
+		string actual;
+		print_symbols(parser, actual);
+		ASSERT_EQ(expected, actual);
+	}
+
+	remove(rewritten.c_str());
+}
+
+TEST(DumpSyms, Compressed)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	FILE* f = fopen(test_pdb.c_str(), "rb");
+	ASSERT_TRUE(f);
+	std::vector<char> pdb;
+	char chunk[4096];
+	size_t numRead;
+	while ((numRead = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		pdb.insert(pdb.end(), chunk, chunk + numRead);
+	fclose(f);
+
+	string dir = make_temp_dir("dump_syms_compressed");
+	std::vector<string> written;
+
+#ifdef HAVE_ZLIB
+	{
+		string gz = dir;
+		join(gz, "TestApp.pdb.gz");
+		gzFile out = gzopen(gz.c_str(), "wb");
+		ASSERT_TRUE(out != nullptr);
+		ASSERT_EQ((int)pdb.size(), gzwrite(out, pdb.data(), (unsigned)pdb.size()));
+		ASSERT_EQ(Z_OK, gzclose(out));
+		written.push_back(gz);
+	}
+#endif
+
+#ifdef HAVE_ZSTD
+	{
+		// Several frames, so that they can be decompressed in parallel
+		string zst = dir;
+		join(zst, "TestApp.pdb.zst");
+		FILE* out = fopen(zst.c_str(), "wb");
+		ASSERT_TRUE(out);
+		const size_t frameSize = 64 * 1024;
+		for (size_t offset = 0; offset < pdb.size(); offset += frameSize)
+		{
+			size_t size = std::min(frameSize, pdb.size() - offset);
+			std::vector<char> frame(ZSTD_compressBound(size));
+			size_t compressed = ZSTD_compress(frame.data(), frame.size(), pdb.data() + offset, size, 3);
+			ASSERT_FALSE(ZSTD_isError(compressed));
+			ASSERT_EQ(compressed, fwrite(frame.data(), 1, compressed, out));
+		}
+		fclose(out);
+		written.push_back(zst);
+	}
+#endif
+
+	for (auto& path : written)
+	{
+		string actual;
+		dump_pdb(path, actual);
+		ASSERT_EQ(expected, actual) << path;
+		remove(path.c_str());
+	}
+}
+
+TEST(DumpSyms, WindowedMapping)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// Small enough that windows get evicted while records in them are still in use
+	{
+		google_breakpad::PDBParser parser;
+		parser.useWindowedMapping(16 * 1024);
+		parser.load(test_pdb.c_str());
+		ASSERT_EQ(nullptr, parser.data());
+
+		string actual;
+		print_symbols(parser, actual);
+		ASSERT_EQ(expected, actual);
+		ASSERT_GT(parser.windowedMapping().Maps(), 1u);
+	}
+
+#ifndef _WIN32
+	// Two streams of holes push the last one well past 4GB into the file, which
+	// only takes up disk space on filesystems without sparse files
+	const uint32_t pageSize = 16 * 1024;
+	std::vector<msf_writer::Stream> streams;
+	streams.push_back(msf_writer::Stream());
+	streams.push_back(msf_writer::infoStream());
+	streams.push_back(msf_writer::Stream(0xC0000000));
+	streams.push_back(msf_writer::Stream(0xC0000000));
+
+	msf_writer::Stream last;
+	for (uint32_t i = 0; i < 3 * pageSize; ++i)
+		last.data.push_back((uint8_t)(i * 7));
+	last.size = (uint32_t)last.data.size();
+	streams.push_back(last);
+
+	string big = make_temp_dir("dump_syms_windowed");
+	join(big, "Big.pdb");
+	ASSERT_TRUE(msf_writer::write(big.c_str(), streams, pageSize, msf_writer::Sequential));
+
+	{
+		google_breakpad::PDBParser parser;
+		parser.useWindowedMapping(1 << 20);
+		parser.load(big.c_str());
+
+		ASSERT_GT((uint64_t)parser.getStream(4).pageIndices[0] * pageSize, 0x100000000ull);
+
+		auto view = parser.getStreamView(4);
+		ASSERT_EQ(last.size, view.size());
+		ASSERT_EQ(0, memcmp(last.data.data(), view.data(), last.size));
+
+		google_breakpad::StreamReader reader = parser.openStream(4);
+		reader.seek(pageSize + 5);
+		ASSERT_EQ(last.data[pageSize + 5], *reader.read<uint8_t>().data);
+	}
+
+	remove(big.c_str());
+#endif
+}
+
+TEST(DumpSyms, Arena)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// Small pages so that plenty of records straddle them
+	std::vector<msf_writer::Stream> streams;
+	{
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		msf_writer::readStreams(parser, streams);
+	}
+
+	string rewritten = make_temp_dir("dump_syms_arena");
+	join(rewritten, "TestApp.pdb");
+	ASSERT_TRUE(msf_writer::write(rewritten.c_str(), streams, 512, msf_writer::Interleaved));
+
+	// Every record is copied when read through the page cache. Printing twice
+	// makes sure nothing from the first time is still pointed at.
+	for (int useArena = 0; useArena < 2; ++useArena)
+	{
+		google_breakpad::PDBParser parser;
+		parser.useArena(useArena != 0);
+		parser.usePageCache(4 * 1024);
+		parser.load(rewritten.c_str());
+
+		for (int i = 0; i < 2; ++i)
+		{
+			string actual;
+			print_symbols(parser, actual);
+			ASSERT_EQ(expected, actual) << "arena " << useArena;
+		}
+	}
+
+	// A record that runs off the end of its stream isn't leaked when it had
+	// to go on the heap
+	{
+		google_breakpad::PDBParser parser;
+		parser.usePageCache(4 * 1024);
+		parser.load(rewritten.c_str());
+
+		auto& stream = parser.getStream(google_breakpad::PDBParser::TypeInfoStream);
+		google_breakpad::StreamReader reader(stream, parser);
+		reader.seek(stream.size - 1);
+		ASSERT_THROW(reader.read<uint8_t>(1024 * 1024), std::runtime_error);
+	}
+
+	remove(rewritten.c_str());
+
+	google_breakpad::Arena arena(1024);
+	void* first = arena.allocate(100);
+	ASSERT_EQ(0u, (uintptr_t)arena.allocate(3) % 8);
+	arena.allocate(1000);
+	ASSERT_EQ(3u, arena.Allocations());
+	ASSERT_EQ(2u, arena.HeapBlocks());
+
+	arena.reset();
+	ASSERT_EQ(first, arena.allocate(100));
+	ASSERT_EQ(2u, arena.HeapBlocks());
+}
+
+TEST(DumpSyms, StringPool)
+{
+	google_breakpad::StringPool pool;
+
+	// The first copy is the one pointed at, unless it's copied
+	string a = "std::vector<int,std::allocator<int> >::push_back";
+	string b = a;
+	auto first = pool.intern(a.c_str(), a.size(), false);
+	auto second = pool.intern(b.c_str(), b.size(), true);
+	ASSERT_EQ(first.id, second.id);
+	ASSERT_EQ(a.c_str(), second.data);
+
+	auto other = pool.intern("main", 4, true);
+	ASSERT_NE(first.id, other.id);
+	ASSERT_STREQ("main", other.data);
+	ASSERT_EQ(2u, pool.Strings());
+	ASSERT_EQ(3u, pool.Lookups());
+
+	// Every thread gets the same id for the same string, whichever of them
+	// got there first
+	const int numThreads = 4;
+	const int numStrings = 5000;
+	std::vector<std::vector<uint32_t>> ids(numThreads);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; ++t)
+	{
+		threads.emplace_back([&pool, &ids, t]() {
+			for (int i = 0; i < numStrings; ++i)
+			{
+				string name = "function" + std::to_string(i);
+				auto interned = pool.intern(name.c_str(), name.size(), true);
+				ASSERT_EQ(name, interned.data);
+				ids[t].push_back(interned.id);
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	for (int t = 1; t < numThreads; ++t)
+		ASSERT_EQ(ids[0], ids[t]);
+	ASSERT_EQ(2u + numStrings, pool.Strings());
+
+	pool.reset();
+	ASSERT_EQ(0u, pool.Strings());
+	ASSERT_NE(a.c_str(), pool.intern(b.c_str(), b.size(), false).data);
+}
+
+TEST(DumpSyms, NulScan)
+{
+	const google_breakpad::NulScan scans[] = {
+		google_breakpad::NulScan::Scalar,
+		google_breakpad::NulScan::SSE2,
+		google_breakpad::NulScan::AVX2,
+	};
+
+	std::vector<uint8_t> buffer(200, 'a');
+	for (auto scan : scans)
+	{
+		if (!google_breakpad::setNulScan(scan))
+			continue;
+
+		// Every length of run, with the terminator at every place in it and nowhere
+		for (size_t size = 0; size < 100; ++size)
+		{
+			const uint8_t* begin = buffer.data() + 3;
+			const uint8_t* end = begin + size;
+			ASSERT_EQ(end, google_breakpad::findNul(begin, end));
+
+			for (size_t at = 0; at < size; ++at)
+			{
+				buffer[3 + at] = 0;
+				ASSERT_EQ(begin + at, google_breakpad::findNul(begin, end)) << (int)scan << " " << size << " " << at;
+				buffer[3 + at] = 'a';
+			}
+
+			// A terminator just past the end doesn't count
+			buffer[3 + size] = 0;
+			ASSERT_EQ(end, google_breakpad::findNul(begin, end));
+			buffer[3 + size] = 'a';
+		}
+	}
+
+	ASSERT_TRUE(google_breakpad::setNulScan(google_breakpad::NulScan::Best));
+}
+
+TEST(DumpSyms, ThreadPool)
+{
+	google_breakpad::ThreadPool pool(3);
+
+	// Sorting only needs moves, and lots of duplicates mustn't slow it down
+	std::vector<std::unique_ptr<uint32_t>> values;
+	std::mt19937 rng(1234);
+	for (uint32_t i = 0; i < 200000; ++i)
+		values.emplace_back(new uint32_t(rng() % (i < 100000 ? 1000000 : 3)));
+
+	auto less = [](const std::unique_ptr<uint32_t>& a, const std::unique_ptr<uint32_t>& b) { return *a < *b; };
+	google_breakpad::parallelSort(values.begin(), values.end(), less, pool);
+	ASSERT_TRUE(std::is_sorted(values.begin(), values.end(), less));
+
+	std::vector<uint32_t> hits(10000);
+	google_breakpad::parallelFor(0, hits.size(), [&hits](size_t i) { ++hits[i]; }, 16, pool);
+	for (auto h : hits)
+		ASSERT_EQ(1u, h);
+
+	// Groups can be waited on from inside tasks, and pass on what they throw
+	std::atomic<uint32_t> ran(0);
+	google_breakpad::TaskGroup outer(pool);
+	for (int i = 0; i < 8; ++i)
+	{
+		outer.run([&ran, &pool]() {
+			google_breakpad::TaskGroup inner(pool);
+			for (int j = 0; j < 8; ++j)
+				inner.run([&ran]() { ++ran; });
+			inner.wait();
+		});
+	}
+	outer.run([]() { throw std::runtime_error("task failed"); });
+	ASSERT_THROW(outer.wait(), std::runtime_error);
+	ASSERT_EQ(64u, ran.load());
+
+	// Waiting only helps with the group's own tasks, never someone else's
+	{
+		google_breakpad::ThreadPool single(1);
+		std::mutex lock;
+		std::condition_variable cv;
+		bool started = false, release = false;
+
+		google_breakpad::TaskGroup blocker(single);
+		blocker.run([&]() {
+			std::unique_lock<std::mutex> guard(lock);
+			started = true;
+			cv.notify_all();
+			cv.wait(guard, [&]() { return release; });
+		});
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			cv.wait(guard, [&]() { return started; });
+		}
+
+		std::atomic<bool> otherRan(false);
+		google_breakpad::TaskGroup other(single);
+		other.run([&otherRan]() { otherRan = true; });
+
+		std::atomic<uint32_t> mine(0);
+		google_breakpad::TaskGroup own(single);
+		for (int i = 0; i < 4; ++i)
+			own.run([&mine]() { ++mine; });
+		own.wait();
+		// Not asserted, which would leave the worker blocked for good
+		EXPECT_EQ(4u, mine.load());
+		EXPECT_FALSE(otherRan.load());
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			release = true;
+		}
+		cv.notify_all();
+		blocker.wait();
+		other.wait();
+		ASSERT_TRUE(otherRan.load());
+	}
+
+	// Without workers everything runs on the caller
+	google_breakpad::ThreadPool inline_pool(0);
+	std::thread::id caller = std::this_thread::get_id();
+	google_breakpad::TaskGroup tg(inline_pool);
+	tg.run([caller]() { ASSERT_EQ(caller, std::this_thread::get_id()); });
+	tg.wait();
+}
+
+TEST(DumpSyms, TypeChunks)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	std::vector<msf_writer::Stream> streams;
+	uint32_t pageSize;
+	{
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		pageSize = parser.pageSize();
+		msf_writer::readStreams(parser, streams);
+	}
+
+	google_breakpad::TypeInfoHeader tih;
+	memcpy(&tih, streams[google_breakpad::PDBParser::TypeInfoStream].data.data(), sizeof(tih));
+	ASSERT_LT(tih.sn, streams.size());
+	ASSERT_GE(tih.tiOff.cb, 16);
+
+	// Types are decoded in chunks that start at the offsets in the table. If
+	// they don't line up with the records the chunks are thrown away and the
+	// stream decoded from the start instead.
+	auto& hash = streams[tih.sn].data;
+	uint32_t* entries = (uint32_t*)(hash.data() + tih.tiOff.off);
+	for (int32_t i = 1; i < tih.tiOff.cb / 8; ++i)
+		entries[i * 2 + 1] += 4;
+
+	string rewritten = make_temp_dir("dump_syms_type_chunks");
+	join(rewritten, "TestApp.pdb");
+	ASSERT_TRUE(msf_writer::write(rewritten.c_str(), streams, pageSize, msf_writer::Sequential));
+
+	string actual;
+	dump_pdb(rewritten, actual);
+	ASSERT_EQ(expected, actual);
+
+	remove(rewritten.c_str());
+}
+
+TEST(DumpSyms, LazyTypes)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// Only the types the functions refer to are decoded
+	uint32_t pageSize;
+	{
+		google_breakpad::PDBParser parser;
+		parser.useLazyTypes(true);
+		parser.load(test_pdb.c_str());
+		pageSize = parser.pageSize();
+
+		string actual;
+		print_symbols(parser, actual);
+		ASSERT_EQ(expected, actual);
+
+		auto& stats = parser.typeStats();
+		ASSERT_GT(stats.decoded, 0u);
+		ASSERT_LT(stats.decoded, stats.types);
+	}
+
+	std::vector<msf_writer::Stream> streams;
+	{
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		msf_writer::readStreams(parser, streams);
+	}
+
+	// Blocks that don't end where the next one starts are taken from the
+	// whole stream decoded in order instead
+	google_breakpad::TypeInfoHeader tih;
+	memcpy(&tih, streams[google_breakpad::PDBParser::TypeInfoStream].data.data(), sizeof(tih));
+	auto& hash = streams[tih.sn].data;
+	uint32_t* entries = (uint32_t*)(hash.data() + tih.tiOff.off);
+	for (int32_t i = 1; i < tih.tiOff.cb / 8; i += 2)
+		entries[i * 2 + 1] += 4;
+
+	string rewritten = make_temp_dir("dump_syms_lazy_types");
+	join(rewritten, "TestApp.pdb");
+	ASSERT_TRUE(msf_writer::write(rewritten.c_str(), streams, pageSize, msf_writer::Interleaved));
+
+	{
+		google_breakpad::PDBParser parser;
+		parser.useLazyTypes(true);
+		parser.load(rewritten.c_str());
+
+		for (int i = 0; i < 2; ++i)
+		{
+			string actual;
+			print_symbols(parser, actual);
+			ASSERT_EQ(expected, actual);
+		}
+	}
+
+	remove(rewritten.c_str());
+}
+
+TEST(DumpSyms, TypeNames)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	google_breakpad::PDBParser parser;
+	parser.load(test_pdb.c_str());
+
+	// Functions with the same argument lists share what they were stringized as
+	string actual;
+	print_symbols(parser, actual);
+	ASSERT_EQ(expected, actual);
+	ASSERT_GT(parser.typeStats().nameHits, 0u);
+	ASSERT_GT(parser.typeStats().nameMisses, 0u);
+
+	// Not when the depth is limited, every name has to be walked to check it
+	google_breakpad::ParseBudget budget;
+	budget.maxTypeDepth = 64;
+	parser.setBudget(budget);
+
+	actual.clear();
+	print_symbols(parser, actual);
+	ASSERT_EQ(expected, actual);
+	ASSERT_EQ(0u, parser.typeStats().nameHits);
+}
+
+TEST(DumpSyms, ChunkWriter)
+{
+	char* buffer = nullptr;
+	size_t buffer_size;
+	FILE* out_file = open_memstream(&buffer, &buffer_size);
+	ASSERT_TRUE(out_file);
+
+	// Chunks are handed over out of order from several threads, but come
+	// out in the order they were claimed, and the writer never holds more
+	// than its capacity
+	const size_t count = 200, capacity = 4, size = 100;
+	string expected;
+	{
+		google_breakpad::ChunkWriter writer(out_file, capacity);
+		size_t first = writer.Claim(count);
+		ASSERT_EQ(0u, first);
+
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([&writer, t]() {
+				for (size_t i = 3 - t; i < count; i += 4)
+					writer.Write(i, string(size, (char)('a' + i % 26)));
+			});
+		}
+		for (auto& t : threads)
+			t.join();
+		writer.Finish();
+
+		ASSERT_LE(writer.PeakBytes(), capacity * size);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		expected.append(size, (char)('a' + i % 26));
+
+	// Dropping a writer with chunks that never arrived doesn't hang
+	{
+		google_breakpad::ChunkWriter writer(out_file, capacity);
+		writer.Claim(2);
+		writer.Write(1, "lost");
+	}
+
+	fclose(out_file);
+#ifdef _WIN32
+	ASSERT_TRUE(close_memstream(out_file));
+#endif
+	string actual(buffer, buffer_size);
+	free(buffer);
+	ASSERT_EQ(expected, actual);
+
+#ifdef __linux__
+	// Writes that fail are remembered, and so is why
+	FILE* full = fopen("/dev/full", "w");
+	ASSERT_TRUE(full);
+	{
+		google_breakpad::ChunkWriter writer(full, capacity);
+		size_t first = writer.Claim(count);
+		for (size_t i = 0; i < count; ++i)
+			writer.Write(first + i, string(size, 'x'));
+		writer.Finish();
+		ASSERT_EQ(ENOSPC, writer.Error());
+	}
+	fclose(full);
+
+	// Which fails the dump, rather than it passing for a whole one
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	full = fopen("/dev/full", "w");
+	ASSERT_TRUE(full);
+	google_breakpad::PDBParser parser;
+	parser.load(test_pdb.c_str());
+	ASSERT_THROW(parser.printBreakpadSymbols(full), std::runtime_error);
+	fclose(full);
+#endif
+}
+
+TEST(DumpSyms, Batch)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// A fragmented copy with the same name, so that the two outputs collide
+	string copy = make_temp_dir("dump_syms_batch_input");
+	join(copy, "TestApp.pdb");
+	{
+		std::vector<msf_writer::Stream> streams;
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		msf_writer::readStreams(parser, streams);
+		ASSERT_TRUE(msf_writer::write(copy.c_str(), streams, 512, msf_writer::Interleaved));
+	}
+
+	string out_dir = make_temp_dir("dump_syms_batch_output");
+	string manifest(out_dir);
+	join(manifest, "manifest.txt");
+	FILE* f = fopen(manifest.c_str(), "w");
+	ASSERT_TRUE(f);
+	fprintf(f, "# Comments and blank lines are skipped\n\n%s\n%s\nmissing.pdb\n", test_pdb.c_str(), copy.c_str());
+	fclose(f);
+
+	// A budget smaller than any PDB only lets one run at a time, and parsers
+	// get reused
+	google_breakpad::BatchDumper dumper(out_dir, 1);
+	ASSERT_TRUE(dumper.AddManifest(manifest.c_str()));
+	dumper.Add(test_pdb);
+	ASSERT_EQ(1u, dumper.Run());
+	ASSERT_EQ(1u, dumper.ParsersCreated());
+	ASSERT_GT(dumper.PeakBytes(), 1u);
+
+	const char* outputs[] = { "TestApp.sym", "TestApp-2.sym", "TestApp-3.sym" };
+	for (auto name : outputs)
+	{
+		string sym(out_dir);
+		join(sym, name);
+		string actual;
+		ASSERT_TRUE(read_file(sym, actual)) << name;
+		ASSERT_EQ(expected, actual) << name;
+		remove(sym.c_str());
+	}
+
+	// Nothing is left behind for the one that failed
+	string missing(out_dir);
+	join(missing, "missing.sym");
+	string unused;
+	ASSERT_FALSE(read_file(missing, unused));
+
+	remove(manifest.c_str());
+	remove(copy.c_str());
+}
+
+TEST(DumpSyms, SymbolStore)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	{
+		google_breakpad::PDBParser parser;
+		parser.load(test_pdb.c_str());
+		ASSERT_EQ("36AD3C9D54314027903A0E96A586A9BD8", parser.debugIdentifier());
+		ASSERT_EQ("TestApp.pdb/36AD3C9D54314027903A0E96A586A9BD8/TestApp.sym", parser.symbolStorePath());
+	}
+
+	// Several writers racing for the same file all succeed, and the one
+	// that is left is whole
+	string root = make_temp_dir("dump_syms_store");
+	join(root, "nested");
+	std::vector<std::thread> threads;
+	std::atomic<uint32_t> failed(0);
+	for (int i = 0; i < 4; ++i)
+	{
+		threads.emplace_back([&test_pdb, &root, &failed]() {
+			try
+			{
+				google_breakpad::PDBParser parser;
+				parser.load(test_pdb.c_str());
+				google_breakpad::BatchDumper::WriteAtomically(parser, root, parser.symbolStorePath());
+			}
+			catch (const std::exception&)
+			{
+				++failed;
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+	ASSERT_EQ(0u, failed.load());
+
+	string sym(root);
+	join(sym, "TestApp.pdb");
+	join(sym, "36AD3C9D54314027903A0E96A586A9BD8");
+	join(sym, "TestApp.sym");
+	string actual;
+	ASSERT_TRUE(read_file(sym, actual));
+	ASSERT_EQ(expected, actual);
+	remove(sym.c_str());
+
+	// Batches write the same layout
+	google_breakpad::BatchDumper dumper(root);
+	dumper.useSymbolStore(true);
+	dumper.Add(test_pdb);
+	ASSERT_EQ(0u, dumper.Run());
+	ASSERT_TRUE(read_file(sym, actual));
+	ASSERT_EQ(expected, actual);
+	remove(sym.c_str());
+}
+
+#ifndef _WIN32
+TEST(DumpSyms, Server)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	string socket_path = make_temp_dir("dump_syms_server");
+	join(socket_path, "dump.sock");
+
+	google_breakpad::DumpServer server;
+	ASSERT_TRUE(server.Start(socket_path.c_str()));
+
+	// By path, from several clients at once
+	std::vector<std::thread> clients;
+	std::vector<string> outputs(4);
+	std::atomic<uint32_t> failed(0);
+	for (size_t i = 0; i < outputs.size(); ++i)
+	{
+		clients.emplace_back([&, i]() {
+			string error;
+			if (!google_breakpad::DumpServer::Request(socket_path.c_str(), test_pdb.c_str(), outputs[i], error))
+				++failed;
+		});
+	}
+	for (auto& c : clients)
+		c.join();
+	ASSERT_EQ(0u, failed.load());
+	for (auto& output : outputs)
+		ASSERT_EQ(expected, output);
+
+	// By fd, which has to be named since there's no path to go by
+	int fd = open(test_pdb.c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0);
+	string output, error;
+	ASSERT_TRUE(google_breakpad::DumpServer::Request(socket_path.c_str(), fd, "TestApp.pdb", output, error)) << error;
+	close(fd);
+	ASSERT_EQ(expected, output);
+
+	// Failures are reported, and don't stop the server
+	ASSERT_FALSE(google_breakpad::DumpServer::Request(socket_path.c_str(), "missing.pdb", output, error));
+	ASSERT_EQ("Failed to load PDB file", error);
+	ASSERT_TRUE(google_breakpad::DumpServer::Request(socket_path.c_str(), test_pdb.c_str(), output, error)) << error;
+	ASSERT_EQ(expected, output);
+
+	// Parsers are kept between requests, at most one for every request that
+	// was in flight at once
+	ASSERT_EQ(7u, server.Requests());
+	ASSERT_LE(server.ParsersCreated(), outputs.size());
+
+	server.Stop();
+	ASSERT_FALSE(google_breakpad::DumpServer::Request(socket_path.c_str(), test_pdb.c_str(), output, error));
+}
+
+TEST(DumpSyms, ServerSilentClients)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	string socket_path = make_temp_dir("dump_syms_silent");
+	join(socket_path, "dump.sock");
+
+	google_breakpad::DumpServer server;
+	ASSERT_TRUE(server.Start(socket_path.c_str()));
+
+	// More clients than the pool has threads, that connect and then never
+	// finish their request, or don't even start it
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path.c_str());
+	std::vector<int> silent;
+	for (size_t i = 0; i < 16; ++i)
+	{
+		int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		ASSERT_GE(sock, 0);
+		ASSERT_EQ(0, connect(sock, (const sockaddr*)&addr, sizeof(addr)));
+		if (i % 2)
+		{
+			ASSERT_EQ(5, send(sock, "DUMP ", 5, 0));
+		}
+		silent.push_back(sock);
+	}
+
+	// Which doesn't hold up anyone else
+	string output, error;
+	ASSERT_TRUE(google_breakpad::DumpServer::Request(socket_path.c_str(), test_pdb.c_str(), output, error)) << error;
+	ASSERT_EQ(expected, output);
+	ASSERT_EQ(1u, server.Requests());
+
+	// Or stopping, which hangs up on them
+	auto start = std::chrono::steady_clock::now();
+	server.Stop();
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+
+	char reply;
+	for (int sock : silent)
+	{
+		ASSERT_EQ(0, recv(sock, &reply, 1, 0));
+		close(sock);
+	}
+}
+#endif
+
+TEST(DumpSyms, Budget)
+{
+	char* testdata_dir = getenv("TESTDATA_DIR");
+	ASSERT_NE(testdata_dir, nullptr)
+		<< "TESTDATA_DIR must be set in the environment!";
+
+	string test_pdb(testdata_dir);
+	join(test_pdb, "TestApp.pdb");
+
+	string test_sym(testdata_dir);
+	join(test_sym, "TestApp.sym");
+	string expected;
+	ASSERT_TRUE(read_file(test_sym, expected));
+
+	// Through the page cache, so that records get copied into arenas
+	google_breakpad::PDBParser parser;
+	parser.usePageCache(1 << 20);
+	parser.load(test_pdb.c_str());
+
+	google_breakpad::ParseBudget budget;
+	string output;
+
+	budget.maxTypeDepth = 1;
+	parser.setBudget(budget);
+	ASSERT_THROW(print_symbols(parser, output), google_breakpad::BudgetExceeded);
+
+	// Only the signatures go when truncating
+	budget.partial = google_breakpad::ParseBudget::Truncate;
+	parser.setBudget(budget);
+	print_symbols(parser, output);
+	ASSERT_STREQ("Types are nested too deeply", parser.budgetExceeded());
+	ASSERT_NE(expected, output);
+	{
+		size_t e = 0, o = 0;
+		while (e < expected.size() && o < output.size())
+		{
+			size_t eEnd = expected.find('\n', e), oEnd = output.find('\n', o);
+			ASSERT_EQ(0u, expected.compare(e, oEnd - o, output, o, oEnd - o));
+			e = eEnd + 1;
+			o = oEnd + 1;
+		}
+		ASSERT_EQ(expected.size(), e);
+		ASSERT_EQ(output.size(), o);
+	}
+
+	budget = google_breakpad::ParseBudget();
+	budget.maxBytes = 1;
+	parser.setBudget(budget);
+	ASSERT_THROW(print_symbols(parser, output), google_breakpad::BudgetExceeded);
+	ASSERT_STREQ("Ran out of memory", parser.budgetExceeded());
+
+	// What was read before running out is still written
+	budget.partial = google_breakpad::ParseBudget::Truncate;
+	parser.setBudget(budget);
+	print_symbols(parser, output);
+	ASSERT_STREQ("Ran out of memory", parser.budgetExceeded());
+	ASSERT_LT(output.size(), expected.size());
+	ASSERT_EQ(expected.substr(0, expected.find('\n') + 1), output.substr(0, output.find('\n') + 1));
+
+	// The modules are cut off in the same place however many tasks decoded
+	// them, a module that finished before an earlier one ran out isn't kept
+	for (budget.maxBytes = 1; ; budget.maxBytes += 16 * 1024)
+	{
+		parser.setBudget(budget);
+		parser.useDecodeTasks(1);
+		string serial;
+		print_symbols(parser, serial);
+		if (!parser.budgetExceeded())
+			break;
+
+		parser.useDecodeTasks(0);
+		for (int i = 0; i < 4; ++i)
+		{
+			print_symbols(parser, output);
+			ASSERT_EQ(serial, output) << budget.maxBytes << " bytes";
+		}
+	}
+	parser.useDecodeTasks(0);
+
+	budget = google_breakpad::ParseBudget();
+	budget.seconds = 1e-9;
+	parser.setBudget(budget);
+	ASSERT_THROW(print_symbols(parser, output), google_breakpad::BudgetExceeded);
+	ASSERT_STREQ("Ran out of time", parser.budgetExceeded());
+
+	// The same parser does the whole thing once the budget allows it
+	parser.setBudget(google_breakpad::ParseBudget());
+	print_symbols(parser, output);
+	ASSERT_EQ(nullptr, parser.budgetExceeded());
+	ASSERT_EQ(expected, output);
+}
@@ -0,0 +1,222 @@
+/* -*- Mode: C++; indent-tabs-mode: t; c-file-style: "linux" -*- */
+// Copyright (C) 2026 agent
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Original author: agent <agent@local>
+
+// Writes MSF files with a chosen page layout, so that tests and benchmarks can
+// exercise fragmented or very large PDBs without having to check them in.
+
+#pragma once
+
+#include "PDBParser.h"
+
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace msf_writer {
+
+struct Stream
+{
+	uint32_t				size;
+	std::vector<uint8_t>	data;	// If empty the pages are left as holes in the file
+
+	Stream() : size(0) {}
+	explicit Stream(uint32_t size) : size(size) {}
+};
+
+enum Layout
+{
+	// Every stream occupies adjacent pages
+	Sequential,
+	// Pages of all streams are dealt out round robin, so no two consecutive
+	// pages of a stream are adjacent unless it is the only one left
+	Interleaved,
+	// Each stream's pages are laid out back to front
+	Reversed,
+};
+
+inline uint32_t numPages(uint64_t size, uint32_t pageSize)
+{
+	return (uint32_t)((size + pageSize - 1) / pageSize);
+}
+
+inline bool writeAt(FILE* f, uint64_t offset, const void* data, size_t size)
+{
+#ifdef _WIN32
+	if (_fseeki64(f, (__int64)offset, SEEK_SET) != 0)
+#else
+	if (fseeko(f, (off_t)offset, SEEK_SET) != 0)
+#endif
+		return false;
+	return fwrite(data, 1, size, f) == size;
+}
+
+// Copies every stream out of an already loaded PDB
+inline void readStreams(google_breakpad::PDBParser& parser, std::vector<Stream>& streams)
+{
+	streams.clear();
+	streams.resize(parser.streamCount());
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		auto view = parser.getStreamView((uint32_t)i);
+		streams[i].size = view.size();
+		streams[i].data.assign(view.data(), view.data() + view.size());
+	}
+}
+
+// Builds the minimal PDB info stream that PDBParser needs, an empty name map
+inline Stream infoStream()
+{
+	Stream s;
+	google_breakpad::NameIndexHeader header = {};
+	header.version = 20000404;
+	header.age = 1;
+	header.guid.Data1 = 0x12345678;
+
+	s.data.resize(sizeof(header) + 4 * sizeof(uint32_t));
+	memcpy(s.data.data(), &header, sizeof(header));
+	s.size = (uint32_t)s.data.size();
+	return s;
+}
+
+// The linker puts the directory at the end of the file, directoryFirst puts it
+// straight after the header instead, which is what lets a reader get started on
+// a PDB before all of it has been read
+inline bool write(const char* path, const std::vector<Stream>& streams, uint32_t pageSize, Layout layout, bool directoryFirst = false)
+{
+	// Page 0 is the header, 1 and 2 are the free page maps
+	uint32_t nextPage = 3;
+
+	std::vector<std::vector<uint32_t>> pages(streams.size());
+	for (size_t i = 0; i < streams.size(); ++i)
+		pages[i].resize(numPages(streams[i].size, pageSize));
+
+	// The directory is the stream count, every stream size, then every page list
+	uint32_t directorySize = (uint32_t)((1 + streams.size()) * sizeof(uint32_t));
+	for (auto& sp : pages)
+		directorySize += (uint32_t)(sp.size() * sizeof(uint32_t));
+
+	std::vector<uint32_t> directoryPages(numPages(directorySize, pageSize));
+	std::vector<uint32_t> indexPages(numPages(directoryPages.size() * sizeof(uint32_t), pageSize));
+
+	auto placeDirectory = [&]() {
+		for (auto& p : directoryPages)
+			p = nextPage++;
+		for (auto& p : indexPages)
+			p = nextPage++;
+	};
+
+	if (directoryFirst)
+		placeDirectory();
+
+	if (layout == Interleaved)
+	{
+		std::vector<uint32_t> assigned(streams.size(), 0);
+		bool any = true;
+		while (any)
+		{
+			any = false;
+			for (size_t i = 0; i < streams.size(); ++i)
+			{
+				if (assigned[i] < pages[i].size())
+				{
+					pages[i][assigned[i]++] = nextPage++;
+					any = true;
+				}
+			}
+		}
+	}
+	else
+	{
+		for (auto& sp : pages)
+		{
+			for (auto& p : sp)
+				p = nextPage++;
+			if (layout == Reversed)
+				std::reverse(sp.begin(), sp.end());
+		}
+	}
+
+	if (!directoryFirst)
+		placeDirectory();
+
+	std::vector<uint32_t> directory;
+	directory.push_back((uint32_t)streams.size());
+	for (auto& s : streams)
+		directory.push_back(s.size);
+	for (auto& sp : pages)
+		directory.insert(directory.end(), sp.begin(), sp.end());
+
+	google_breakpad::PDBHeader header = {};
+	memcpy(header.signature, "Microsoft C/C++ MSF 7.00\r\n\032DS\0\0", sizeof(header.signature));
+	header.pageSize = pageSize;
+	header.freePageMap = 1;
+	header.pagesUsed = nextPage;
+	header.directorySize = directorySize;
+
+	if (sizeof(header) + indexPages.size() * sizeof(uint32_t) > pageSize)
+		return false;
+
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+
+	// Make sure the file covers every page first, even if the last ones are holes
+	uint8_t zero = 0;
+	bool ok = writeAt(f, (uint64_t)nextPage * pageSize - 1, &zero, 1)
+		&& writeAt(f, 0, &header, sizeof(header))
+		&& writeAt(f, sizeof(header), indexPages.data(), indexPages.size() * sizeof(uint32_t));
+
+	for (size_t i = 0; ok && i < streams.size(); ++i)
+	{
+		if (streams[i].data.empty())
+			continue;
+
+		for (size_t p = 0; ok && p < pages[i].size(); ++p)
+		{
+			uint32_t offset = (uint32_t)p * pageSize;
+			ok = writeAt(f, (uint64_t)pages[i][p] * pageSize, streams[i].data.data() + offset,
+				std::min(pageSize, streams[i].size - offset));
+		}
+	}
+
+	const uint8_t* dirData = (const uint8_t*)directory.data();
+	for (size_t p = 0; ok && p < directoryPages.size(); ++p)
+	{
+		uint32_t offset = (uint32_t)p * pageSize;
+		ok = writeAt(f, (uint64_t)directoryPages[p] * pageSize, dirData + offset, std::min(pageSize, directorySize - offset));
+	}
+
+	const uint8_t* indexData = (const uint8_t*)directoryPages.data();
+	uint32_t indexSize = (uint32_t)(directoryPages.size() * sizeof(uint32_t));
+	for (size_t p = 0; ok && p < indexPages.size(); ++p)
+	{
+		uint32_t offset = (uint32_t)p * pageSize;
+		ok = writeAt(f, (uint64_t)indexPages[p] * pageSize, indexData + offset, std::min(pageSize, indexSize - offset));
+	}
+
+	return fclose(f) == 0 && ok;
+}
+
+} // namespace msf_writer
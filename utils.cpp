@@ -22,8 +22,17 @@
 // Original author: Jake Shadle <jake.shadle@frostbite.com>
 
 #include "utils.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
 #ifdef _WIN32
+#include <direct.h>
+#include <io.h>
 #include <windows.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
 #endif
 
 #ifdef _WIN32
@@ -63,3 +72,97 @@ char* strupper(char* str)
 
 	return str;
 }
+
+void appendFormat(std::string& out, const char* format, ...)
+{
+	// Nearly every record fits in this, so the common case formats just once
+	char buffer[512];
+
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+
+	if ((size_t)len < sizeof(buffer))
+	{
+		out.append(buffer, (size_t)len);
+		return;
+	}
+
+	size_t start = out.size();
+	out.resize(start + len + 1);
+
+	va_start(args, format);
+	vsnprintf(&out[start], (size_t)len + 1, format, args);
+	va_end(args);
+
+	out.resize(start + len);
+}
+
+bool getPageFaults(PageFaults& faults)
+{
+#ifdef _WIN32
+	// GetProcessMemoryInfo doesn't tell hard and soft faults apart
+	faults.major = faults.minor = 0;
+	return false;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return false;
+
+	faults.major = (uint64_t)usage.ru_majflt;
+	faults.minor = (uint64_t)usage.ru_minflt;
+	return true;
+#endif
+}
+
+bool makeDirectories(const std::string& path)
+{
+	if (path.empty())
+		return true;
+
+	// Every parent first, skipping a leading separator or drive
+	for (size_t pos = path.find_first_of("/\\", 1); pos != std::string::npos; pos = path.find_first_of("/\\", pos + 1))
+	{
+		if (path[pos - 1] == ':' || path[pos - 1] == '/' || path[pos - 1] == '\\')
+			continue;
+
+		std::string parent = path.substr(0, pos);
+#ifdef _WIN32
+		if (_mkdir(parent.c_str()) != 0 && errno != EEXIST)
+#else
+		if (mkdir(parent.c_str(), 0777) != 0 && errno != EEXIST)
+#endif
+			return false;
+	}
+
+#ifdef _WIN32
+	return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+	return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+}
+
+bool syncFile(FILE* file)
+{
+	if (fflush(file) != 0 || ferror(file))
+		return false;
+
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+bool replaceFile(const char* from, const char* to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
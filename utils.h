@@ -23,8 +23,38 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
 #include <string>
 
 std::string getHResultString(long code);
 
 char* strupper(char* str);
+
+// Appends printf style formatted text to out
+void appendFormat(std::string& out, const char* format, ...)
+#ifdef __GNUC__
+	__attribute__((format(printf, 2, 3)))
+#endif
+	;
+
+struct PageFaults
+{
+	uint64_t major;	//!< Faults that had to wait on I/O
+	uint64_t minor;
+};
+
+// Gets the page faults the process has taken so far, false if the platform can't tell us
+bool getPageFaults(PageFaults& faults);
+
+// Creates a directory and any of its parents that don't exist yet. Other
+// processes creating the same ones at the same time is fine.
+bool makeDirectories(const std::string& path);
+
+// Flushes file and waits for what was written to it to reach the disk, false
+// if any of it couldn't be written
+bool syncFile(FILE* file);
+
+// Renames from over to, replacing to if it exists. Readers of to see either
+// the old file or the new one, never part of one.
+bool replaceFile(const char* from, const char* to);